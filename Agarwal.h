@@ -7,6 +7,7 @@
 #include "EqualTimeDistance.h"
 
 #include <vector>
+#include <climits>
 
 // This class contains all logic need to compute a simplification
 // of any input trajectory using agarwal simplification with
@@ -20,45 +21,52 @@ class AgarwalSimplification {
 	std::vector<Vertex> simpBuffer;
 	std::vector<double> simpDistances;
 	std::vector<double> simpTotals;
+	std::vector<int> sourceIndex;
 
 public:
-	// wrapper for the simplify function
-	TrajectorySimplification* simplify(Trajectory &t, double simplificationEpsilon) {
+	// wrapper for the simplify function, the simplification data is allocated from arena
+	// Stops after maxSize + 1 vertices, the simplification is then incomplete.
+	TrajectorySimplification* simplify(Trajectory &t, double simplificationEpsilon, Arena &arena, int maxSize = INT_MAX) {
 		TrajectorySimplification* simplified = new TrajectorySimplification();
-		simplified->name = t.name + "[simplified]";
 		simplified->simplificationEpsilon = simplificationEpsilon;
 		simplified->source = &t;
 
-		simplify(t, *simplified, simplificationEpsilon);
+		simplify(t, *simplified, simplificationEpsilon, arena, maxSize);
 
 		return simplified;
 	}
 
 	// uses agarwal to simplify (t) into (simplification) with agarwal epsilon (simplificationEpsilon)
-	void simplify(Trajectory &t, TrajectorySimplification &simplification, double simplificationEpsilon) {
+	void simplify(Trajectory &t, TrajectorySimplification &simplification, double simplificationEpsilon, Arena &arena, int maxSize = INT_MAX) {
 		// reset temp data
 		simpBuffer.clear();
 		simpDistances.clear();
 		simpTotals.clear();
+		sourceIndex.clear();
 
 		// initialize first vertex
-		std::vector<Vertex> &P = t.vertices;
+		ArenaArray<Vertex> &P = t.vertices;
 		simpBuffer.push_back(P[0]);
+		sourceIndex.push_back(t.sourceIndex[0]);
 		simpDistances.push_back(0);
 		simpTotals.push_back(0);
 
-		int simpSize = 1;
-
 		int rangeStart = 1;
 		int prevk = 0;
 		while (true) {
 			// find last index of (t) satisfying (simplificationEpsilon), given current index (prevk)
-			int k = findLastFrechetMatch(P, simpBuffer, t.totals, simpTotals, t.distances, simpDistances, simpSize, rangeStart, t.size, prevk, simplificationEpsilon, simplification.portals);
-			// put vertex (k) of (t) into simplification
-			simpSize++;
-			simpBuffer[simpSize - 1] = P[k];
-			// check if we reached the end
-			if (k == t.size - 1) {
+			int k = findLastFrechetMatch(t, rangeStart, t.size, prevk, simplificationEpsilon);
+			// put vertex (k) of (t) into simplification, with the length of its segment
+			Vertex &prev = simpBuffer.back();
+			double dx = P[k].x - prev.x;
+			double dy = P[k].y - prev.y;
+			double d = sqrt(dx*dx + dy*dy);
+			simpBuffer.push_back(P[k]);
+			simpDistances.push_back(d);
+			simpTotals.push_back(simpTotals.back() + d);
+			sourceIndex.push_back(t.sourceIndex[k]);
+			// check if we reached the end, or have too many vertices already
+			if (k == t.size - 1 || simpBuffer.size() > maxSize) {
 				break;
 			}
 			prevk = k;
@@ -67,46 +75,25 @@ public:
 
 		// copy temp data into simplification
 		simplification.size = simpBuffer.size();
-		simplification.vertices = simpBuffer;
-		simplification.distances = simpDistances;
-		simplification.totals = simpTotals;
+		simplification.vertices.assign(arena, simpBuffer);
+		simplification.distances.assign(arena, simpDistances);
+		simplification.totals.assign(arena, simpTotals);
+		simplification.sourceIndex.assign(arena, sourceIndex);
+		simplification.computeSegments(arena);
 	}
 
 private:
 	// Finds index k of last vertex v that still satisfies 
-	// the simplification epsilon 
-	int findLastFrechetMatch(
-		std::vector<Vertex> &P, std::vector<Vertex> &simp,
-		std::vector<double> &ptotals, std::vector<double> &simptotals,
-		std::vector<double> &pdists, std::vector<double> &simpdists,
-		int simpSize,
-		int start, int end, int prevk, double epsilon,
-		std::vector<Portal> &portals) {
-
-		// add temporary data which we modify with double & search
-		simp.push_back(P[0]);
-		simpdists.push_back(0);
-		simpTotals.push_back(0);
-
-		// Use lambda's to easily double & search the function from (start) to (end)
+	// the simplification epsilon. Every probe is the closed form
+	// equal time distance of the subtrajectory to the segment (prevk, index),
+	// which stops as soon as epsilon is exceeded.
+	int findLastFrechetMatch(Trajectory &t, int start, int end, int prevk, double epsilon) {
+		Vertex *P = t.vertices.data();
+		double *totals = t.totals.data();
+		double limitSQ = epsilon * epsilon;
 		return doubleNsearch(
 			[&](int index) -> bool {
-				// update temporary data to reflect double&search choice
-				simp[simpSize] = P[index];
-				double dx = simp[simpSize].x - simp[simpSize - 1].x;
-				double dy = simp[simpSize].y - simp[simpSize - 1].y;
-				double d = sqrt(dx*dx + dy*dy);
-				simpdists[simpSize] = d;
-				simptotals[simpSize] = simptotals[simpSize - 1] + d;
-				// calculate upper bound to subtrajectory frechet with ETD
-				double dist = equalTimeDistance(
-					P, simp,
-					ptotals, simptotals,
-					pdists, simpdists,
-					index + 1, simpSize + 1,
-					prevk, simpSize - 1
-				);
-				// tell double & search whether its a match
+				double dist = sqrt(segmentEqualTimeDistanceSQ(P, totals, prevk, index, P[prevk], P[index], limitSQ));
 				return dist <= epsilon;
 			},
 			start,
@@ -117,4 +104,4 @@ private:
 	}
 
 
-};
\ No newline at end of file
+};
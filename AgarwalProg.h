@@ -23,20 +23,19 @@ class ProgressiveAgarwal {
 	std::vector<int> sourceIndex;
 
 public:
-	// wrapper for the simplify function
-	TrajectorySimplification* simplify(Trajectory &parent, Trajectory &sourceTrajectory, double simplificationEpsilon) {
+	// wrapper for the simplify function, the simplification data is allocated from arena
+	TrajectorySimplification* simplify(Trajectory &parent, Trajectory &sourceTrajectory, double simplificationEpsilon, Arena &arena) {
 		TrajectorySimplification* simplified = new TrajectorySimplification();
-		simplified->name = parent.name + "[simplified]";
 		simplified->simplificationEpsilon = simplificationEpsilon;
 		simplified->source = &parent;
 
-		simplify(parent, *simplified, sourceTrajectory, simplificationEpsilon);
+		simplify(parent, *simplified, sourceTrajectory, simplificationEpsilon, arena);
 		
 		return simplified;
 	}
 
 	// uses agarwal to simplify (t) into (simplification) with agarwal epsilon (simplificationEpsilon)
-	void simplify(Trajectory &parent, TrajectorySimplification &simplification, Trajectory &sourceTrajectory, double simplificationEpsilon) {
+	void simplify(Trajectory &parent, TrajectorySimplification &simplification, Trajectory &sourceTrajectory, double simplificationEpsilon, Arena &arena) {
 		// reset temp data
 		simpBuffer.clear();
 		simpDistances.clear();
@@ -44,22 +43,25 @@ public:
 		sourceIndex.clear();
 
 		// initialize first vertex
-		std::vector<Vertex> &P = parent.vertices;
+		ArenaArray<Vertex> &P = parent.vertices;
 		simpBuffer.push_back(P[0]);
 		simpDistances.push_back(0);
 		simpTotals.push_back(0);
 		sourceIndex.push_back(0);
 
-		int simpSize = 1;
-
 		int rangeStart = 1;
 		int prevk = 0;
 		while (true) {
 			// find last index of (t) satisfying (simplificationEpsilon), given current index (prevk)
-			int k = findLastFrechetMatch(P, simpBuffer, parent.totals, simpTotals, parent.distances, simpDistances, simpSize, rangeStart, parent.size, prevk, simplificationEpsilon, parent.sourceIndex, sourceTrajectory, simplification.portals);
-			// put vertex (k) of (t) into simplification
-			simpSize++;
-			simpBuffer[simpSize - 1] = P[k];
+			int k = findLastFrechetMatch(parent, rangeStart, parent.size, prevk, simplificationEpsilon, sourceTrajectory, simplification.portals);
+			// put vertex (k) of (t) into simplification, with the length of its segment
+			Vertex &prev = simpBuffer.back();
+			double dx = P[k].x - prev.x;
+			double dy = P[k].y - prev.y;
+			double d = sqrt(dx*dx + dy*dy);
+			simpBuffer.push_back(P[k]);
+			simpDistances.push_back(d);
+			simpTotals.push_back(simpTotals.back() + d);
 			sourceIndex.push_back(parent.sourceIndex[k]);
 			// check if we reached the end
 			if (k == parent.size - 1) {
@@ -71,56 +73,41 @@ public:
 
 		// copy temp data into simplification
 		simplification.size = simpBuffer.size();
-		simplification.vertices = simpBuffer;
-		simplification.distances = simpDistances;
-		simplification.totals = simpTotals;
-		simplification.sourceIndex = sourceIndex;
+		simplification.vertices.assign(arena, simpBuffer);
+		simplification.distances.assign(arena, simpDistances);
+		simplification.totals.assign(arena, simpTotals);
+		simplification.sourceIndex.assign(arena, sourceIndex);
+		simplification.computeSegments(arena);
 	}
 
 private:
 	// Finds index k of last vertex v that still satisfies 
-	// the simplification epsilon 
+	// the simplification epsilon. Every probe is the closed form equal time
+	// distance of the source subtrajectory to the segment (prevk, index),
+	// which is also recorded as a freespace jump (portal).
 	int findLastFrechetMatch(
-		std::vector<Vertex> &P, std::vector<Vertex> &simp,
-		std::vector<double> &ptotals, std::vector<double> &simptotals,
-		std::vector<double> &pdists, std::vector<double> &simpdists,
-		int simpSize,
+		Trajectory &parent,
 		int start, int end, int prevk, double epsilon,
-		std::vector<int> &parentSourceIndices,
 		Trajectory &sourceTrajectory,
 		std::vector<Portal> &portals) {
-
-		// add temporary data which we modify with double & search
-		simp.push_back(P[0]);
-		simpdists.push_back(0);
-		simpTotals.push_back(0);
-
-		// Use lambda's to easily double & search the function from (start) to (end)
+		ArenaArray<Vertex> &P = parent.vertices;
+		ArenaArray<int> &parentSourceIndices = parent.sourceIndex;
+		int sourceStart = parentSourceIndices[prevk];
 		return doubleNsearch(
 			[&](int index) -> bool {
-				// update temporary data to reflect double&search choice
-				simp[simpSize] = P[index];
-				double dx = simp[simpSize].x - simp[simpSize - 1].x;
-				double dy = simp[simpSize].y - simp[simpSize - 1].y;
-				double d = sqrt(dx*dx + dy*dy);
-				simpdists[simpSize] = d;
-				simptotals[simpSize] = simptotals[simpSize - 1] + d;
-				int end = 0;
-				int start = parentSourceIndices[prevk];
+				int sourceEnd = 0;
 				if (index + 1 >= parentSourceIndices.size()) {
-					end = sourceTrajectory.size;
+					sourceEnd = sourceTrajectory.size;
 				}
 				else {
-					end = parentSourceIndices[index + 1];
+					sourceEnd = parentSourceIndices[index + 1];
 				}
 				// calculate upper bound to subtrajectory frechet with ETD
-				double dist = equalTimeDistance(
-					sourceTrajectory.vertices, simp,
-					sourceTrajectory.totals, simptotals,
-					sourceTrajectory.distances, simpdists,
-					end, simpSize + 1,
-					start, simpSize - 1
-				);
+				double dist = sqrt(segmentEqualTimeDistanceSQ(
+					sourceTrajectory.vertices.data(), sourceTrajectory.totals.data(),
+					sourceStart, sourceEnd - 1,
+					P[prevk], P[index], DBL_MAX
+				));
 				// construct freespace jump (portal) from data
 				Portal p;
 				p.source = prevk;
@@ -136,4 +123,4 @@ private:
 			doubleNSearchExponentStep
 		);
 	}
-};
\ No newline at end of file
+};
@@ -7,6 +7,7 @@
 #pragma once
 
 #include "DiHash.h"
+#include "EndpointIndex.h"
 #include "Algorithm.h"
 #include "Trajectory.h"
 #include "FileIO.h"
@@ -16,34 +17,90 @@
 
 // pre-processing steps --------------------------------------------------------------
 
-int slotsPerDimension = 500;
-double tolerance = 0.00001;
+const int maxSlotsPerDimension = 2048;
+const double tolerance = 0.00001;
 
-// Preprocessing step. Inserts start and endpoints in a regular grid so they can be used
-// for range queries later.
-void addPtsToDiHash(AlgoData &a) {
-	a.diHash = new DiHash(*a.boundingBox, slotsPerDimension, tolerance);
+// Median delta of the range queries (or the join delta), 0 if there are none
+inline double medianQueryDelta(AlgoData &a) {
+	if (a.joinDelta > 0) return a.joinDelta;
+	std::vector<double> deltas;
+	if (a.queries != nullptr) {
+		for (Query &q : *a.queries) {
+			if (q.knn == 0) deltas.push_back(q.queryDelta);
+		}
+	}
+	if (deltas.empty()) return 0;
+	std::nth_element(deltas.begin(), deltas.begin() + deltas.size() / 2, deltas.end());
+	return deltas[deltas.size() / 2];
+}
+
+// Picks the DiHash resolution so that a cell is about as wide as the median query delta,
+// which makes a typical query touch 3x3 cells. The number of cells is capped relative
+// to the number of endpoints, dense cells are refined by the DiHash itself.
+inline int chooseSlotsPerDimension(AlgoData &a, int numPoints) {
+	if (a.slotsPerDimension > 0) return a.slotsPerDimension;
+	double extent = std::max(a.boundingBox->maxx - a.boundingBox->minx, a.boundingBox->maxy - a.boundingBox->miny);
+	int maxSlots = std::min(maxSlotsPerDimension, std::max(1, (int)(2 * sqrt((double)numPoints))));
+	double medianDelta = medianQueryDelta(a);
+	if (!(extent > 0) || !(medianDelta > 0)) {
+		return maxSlots;
+	}
+	double slots = extent / medianDelta;
+	return (int)std::max(1.0, std::min((double)maxSlots, slots));
+}
+
+// Preprocessing step. Inserts start points, each with its endpoint, in a regular grid so they
+// can be used for range queries later. With USE_ENDPOINT_INDEX, the (start, end) pairs are put in a
+// joint 4D kd-tree instead, so both endpoints are filtered inside the index.
+inline void addPtsToDiHash(AlgoData &a) {
+	a.diHash = nullptr;
+	a.endpointIndex = nullptr;
+#if USE_ENDPOINT_INDEX
+	a.endpointIndex = new EndpointIndex();
+	for (Trajectory *t : *a.trajectories) {
+		if (t != nullptr) {
+			a.endpointIndex->addTrajectory(t->vertices[0], t->vertices[t->size - 1], t->uniqueIDInDataset);
+		}
+	}
+	a.endpointIndex->build();
+#else
+	int numPoints = 0;
+	for (Trajectory *t : *a.trajectories) {
+		if (t != nullptr) numPoints += 2;
+	}
+	a.diHash = new DiHash(*a.boundingBox, chooseSlotsPerDimension(a, numPoints), tolerance);
 	for (Trajectory *t : *a.trajectories) {
 		if (t != nullptr) {
-			a.diHash->addPoint(t->vertices[0]);
-			a.diHash->addPoint(t->vertices[t->size - 1]);
+			a.diHash->addPoint(t->vertices[0], t->vertices[t->size - 1], t->uniqueIDInDataset);
 		}
 	}
+	a.diHash->freeze();
+#endif
 }
 
-// number of simplification steps constructed for each trajectory
-int numSimplifications = 4;
-int avgs[4];
-int count = 0;
 
+// Collects the useful freespace jumps of the first (size) simplifications of t into
+// t.simpPortals. After this, the table is read-only and can be shared between threads.
+inline void compilePortals(Trajectory &t, int size, Arena &arena) {
+	std::vector<Portal> candidates;
+	for (int i = 0; i < size; i++) {
+		for (Portal &p : t.simplifications[i]->portals) {
+			// check if it is a useful portal
+			if (p.destination - p.source != 1) {
+				candidates.push_back(p);
+			}
+		}
+	}
+	// sorts by source, then destination, and drops duplicates
+	t.simpPortals.build(candidates, t.size, arena);
+}
 
-// the averages of all learned simplifications
-// TODO: is not properly handled for parallel execution
-double avgsBBRatio[4];
-
+// the epsilon search of a simplification stops when its vertex count is within this fraction of the target
+const double simplificationSlack = 0.1;
 
 // Calculates numSimplification trajectory simplifications for one trajectory
-void makeSimplificationsForTrajectory(Trajectory &t, double diagonal, AlgorithmObjects &algo, int size) {
+// The simplifications are allocated from arena.
+inline void makeSimplificationsForTrajectory(Trajectory &t, double diagonal, AlgorithmObjects &algo, int size, Arena &arena) {
 	// target ratio of input vertices for simps
 	double targets[4] = {.07, .19, .24, .32};
 
@@ -56,7 +113,7 @@ void makeSimplificationsForTrajectory(Trajectory &t, double diagonal, AlgorithmO
 	targetCounts[0] = std::min(18, targetCounts[0]);//start simple in case dihash is useless
 
 	// construct upper and lowerbounds for bsearching epsilon
-	double diag = t.boundingBox->getDiagonal();
+	double diag = t.boundingBox.getDiagonal();
 	double lowerBound = diagonal / 100000;
 	double upperBound = diagonal / 2;
 	// number of bsearch steps
@@ -73,9 +130,15 @@ void makeSimplificationsForTrajectory(Trajectory &t, double diagonal, AlgorithmO
 			[&](double value) -> int {
 				newUpperbound = value;
 				if (simp != nullptr) delete simp;
-				simp = algo.agarwal.simplify(t, value);
+				// rejected tries are built in the scratch arena, which is recycled for every try
+				algo.scratchArena.reset();
+				// a try close enough to the target count is kept, others only have to tell whether there
+				// are too many vertices, so they stop early. The last try is always complete.
+				int slack = targetCounts[i] * simplificationSlack;
+				int maxSize = tries == 9 ? INT_MAX : targetCounts[i] + slack;
+				simp = algo.agarwal.simplify(t, value, algo.scratchArena, maxSize);
 				tries++;
-				if (tries == 10) {
+				if (tries == 10 || std::abs(simp->size - targetCounts[i]) <= slack) {
 					return -1;
 				}
 				else {
@@ -90,122 +153,78 @@ void makeSimplificationsForTrajectory(Trajectory &t, double diagonal, AlgorithmO
 		numIterations -= 2;
 		double ratio = simp->size/(double)t.size;
 		// apply epsilon learning for query trajectories
-		avgsBBRatio[i] += newUpperbound / diagonal;
+		algo.avgsBBRatio[i] += newUpperbound / diagonal;
+		simp->copyInto(arena);
 		t.simplifications.push_back(simp);
 	}
-	count++;
+	algo.learnedCount++;
 
 	/*
 	// debug code used to check how close the bsearch is to the target vertex ratio
 	for (int i = 0; i < size; i++) {
-		TrajectorySimplification* ts = algo.agarwal.simplify(t, simplificationEpsilon / (6 * (i + .25)));
+		TrajectorySimplification* ts = algo.agarwal.simplify(t, simplificationEpsilon / (6 * (i + .25)), algo.scratchArena);
 		int diff = ts->size - t.simplifications[i]->size;
 		avgs[i] += diff;
 	}
-	double avg = avgs[2] / (double)count;
+	double avg = avgs[2] / (double)algo.learnedCount;
 	std::cout << "avg " << avg << "\n";
 	*/
 
-	// compile portals from simplifications to source trajectory
-	for (int i = 0; i < size; i++) {
-		for (Portal &p : t.simplifications[i]->portals) {
-			// check if it is a useful portal
-			if (p.destination - p.source != 1) {
-				// check if it is not a duplicate
-				bool found = false;
-				for (Portal &q : t.simpPortals[p.source]) {
-					if (q.destination == p.destination) {
-						found = true;
-					}
-				}
-				if (!found) {
-					t.simpPortals[p.source].push_back(p);
-				}
-			}
-		}
-	}
-	//sort portals from small to large (these are many sorts but on small sets)
-	for (std::map<int, std::vector<Portal>>::iterator iter = t.simpPortals.begin(); iter != t.simpPortals.end(); ++iter)
-	{	
-		std::vector<Portal> &k = iter->second;
-		std::sort(k.begin(), k.end(), portalCompare);
-	}
+	compilePortals(t, size, arena);
 }
 
 // Calculates numSimplification trajectory simplifications for one trajectory, using guesswork instead of binary search
-void makeSourceSimplificationsForTrajectory(Trajectory &t, Trajectory &source, double diagonal, AlgorithmObjects &algo, int size) {
+// The simplifications are allocated from arena.
+inline void makeSourceSimplificationsForTrajectory(AlgoData &a, Trajectory &t, Trajectory &source, double diagonal, AlgorithmObjects &algo, int size, Arena &arena) {
 	// apply learned ratio from avgsBBRatio
 	for (int i = 0; i < size; i++) {
-		double eps = diagonal * (avgsBBRatio[i]/count);
-		t.simplifications.push_back(algo.agarwalProg.simplify(t, source, eps));
-	}
-	// compile portals
-	for (int i = 0; i < size; i++) {
-		for (Portal &p : t.simplifications[i]->portals) {
-			// check if it is a useful portal
-			if (p.destination - p.source != 1) {
-				// check if it is not a duplicate
-				bool found = false;
-				for (Portal &q : t.simpPortals[p.source]) {
-					if (q.destination == p.destination) {
-						found = true;
-					}
-				}
-				if (!found) {
-					t.simpPortals[p.source].push_back(p);
-				}
-			}
-		}
-	}
-	//sort portals from small to large
-	for (std::map<int, std::vector<Portal>>::iterator iter = t.simpPortals.begin(); iter != t.simpPortals.end(); ++iter)
-	{
-		std::vector<Portal> &k = iter->second;
-		std::sort(k.begin(), k.end(), portalCompare);
+		double eps = diagonal * (a.avgsBBRatio[i]/a.learnedCount);
+		t.simplifications.push_back(algo.agarwalProg.simplify(t, source, eps, arena));
 	}
+	compilePortals(t, size, arena);
 }
 
-void makeSimplificationsForTrajectory(Trajectory &t, AlgorithmObjects &algo) {
-	makeSimplificationsForTrajectory(t, t.boundingBox->getDiagonal(), algo, numSimplifications);
+inline void makeSimplificationsForTrajectory(Trajectory &t, AlgorithmObjects &algo) {
+	makeSimplificationsForTrajectory(t, t.boundingBox.getDiagonal(), algo, numSimplifications, *algo.arena);
 }
 
-void loadAndSimplifyTrajectory(std::string &tname, int tIndex, AlgorithmObjects &algo, AlgoData &a) {
-	Trajectory *t = algo.fio.parseTrajectoryFile(tname, tIndex);
-	if (t->size == 1) {
+inline void loadAndSimplifyTrajectory(std::string &tname, int tIndex, AlgorithmObjects &algo, AlgoData &a) {
+	Trajectory *t = a.datasetPoints != nullptr
+		? algo.fio.makeTrajectory(a.datasetPoints->at(tIndex), tname, tIndex, *algo.arena)
+		: algo.fio.parseTrajectoryFile(tname, tIndex, *algo.arena);
+	if (t->size <= 1) {
 		delete t;
 		// ugly but necessary
 		a.trajectories->at(tIndex) = nullptr;
 		return;
 	}
 	// add to bbox used by dihash
-	algo.bbox.addPoint(t->boundingBox->minx, t->boundingBox->miny);
-	algo.bbox.addPoint(t->boundingBox->maxx, t->boundingBox->maxy);
+	algo.bbox.addPoint(t->boundingBox.minx, t->boundingBox.miny);
+	algo.bbox.addPoint(t->boundingBox.maxx, t->boundingBox.maxy);
 	makeSimplificationsForTrajectory(*t, algo);
 	a.trajectories->at(tIndex) = t;
 
 }
 
 
-// Mutex guarding access to the dataset from the worker threads
-std::mutex simplificationMTX;
 // Number of loads/simplifications allocated to a worker as one 'job'
-int simplificationBatchSize = 20;
+const int simplificationBatchSize = 20;
 
 // Returns a trajectory index for the worker to load/simplify, locking the trajectory set
-int getConcurrentTrajectory(AlgoData *a) {
-	simplificationMTX.lock();
+inline int getConcurrentTrajectory(AlgoData *a) {
+	a->simplificationMtx.lock();
 	if (a->startedSimplifying > a->trajectories->size()) {
-		simplificationMTX.unlock();
+		a->simplificationMtx.unlock();
 		return -1;
 	}
 	int returnTrajectory = a->startedSimplifying;
 	a->startedSimplifying += simplificationBatchSize;
-	simplificationMTX.unlock();
+	a->simplificationMtx.unlock();
 	return returnTrajectory;
 }
 
 // obtains a piece of the dataset which it loads and simplifies
-void simplificationWorker(AlgoData *a, AlgorithmObjects *algo) {
+inline void simplificationWorker(AlgoData *a, AlgorithmObjects *algo) {
 	int current = getConcurrentTrajectory(a);
 	std::vector<std::string> &trajectories = *a->trajectoryNames;
 	while (current != -1) {
@@ -222,17 +241,20 @@ void simplificationWorker(AlgoData *a, AlgorithmObjects *algo) {
 }
 
 
-std::vector<std::thread*> simplificationThreads;
-std::vector<AlgorithmObjects*> algos;
-
-
 // Preprocessing step. Calculates simplifications for all trajectories in the dataset
-void constructSimplifications(AlgoData &a) {
+inline void constructSimplifications(AlgoData &a) {
+	std::vector<std::thread*> simplificationThreads;
+	std::vector<AlgorithmObjects*> algos;
 	a.trajectories = new std::vector<Trajectory*>();
 	a.trajectories->resize(a.numTrajectories);
+	a.startedSimplifying = 0;
 	// spawn workers which load/simplify
 	for (int i = 0; i < a.numWorkers; i++) {
 		AlgorithmObjects *algo = new AlgorithmObjects();
+		algo->fio.sharePackedDataset(a.fio);
+		// dataset trajectories live in per-worker arenas owned by AlgoData
+		algo->arena = new Arena(16 * 1024 * 1024);
+		a.arenas.push_back(algo->arena);
 		std::thread *t = new std::thread(simplificationWorker, &a, algo);
 		simplificationThreads.push_back(t);
 		algos.push_back(algo);
@@ -243,114 +265,575 @@ void constructSimplifications(AlgoData &a) {
 		AlgorithmObjects *algo = algos[i];
 		a.boundingBox->addPoint(algo->bbox.minx, algo->bbox.miny);
 		a.boundingBox->addPoint(algo->bbox.maxx, algo->bbox.maxy);
+		// the learned simplification epsilons of all workers
+		for (int j = 0; j < numSimplifications; j++) {
+			a.avgsBBRatio[j] += algo->avgsBBRatio[j];
+		}
+		a.learnedCount += algo->learnedCount;
 		delete simplificationThreads[i];
 		delete algo;
 	}
+}
+
+
+
+
 
-	//cleanup
-	algos.clear();
-	simplificationThreads.clear();
-	std::cout << "done";
+
+// maps every loaded dataset trajectory name to its index, so queries on dataset members can reuse them
+inline void buildDatasetIndex(AlgoData &a) {
+	std::vector<std::string> &names = *a.trajectoryNames;
+	a.datasetIndex.clear();
+	a.datasetIndex.reserve(names.size());
+	for (int i = 0; i < names.size(); i++) {
+		if (a.trajectories->at(i) != nullptr) {
+			a.datasetIndex[names[i]] = i;
+			a.datasetVertices += a.trajectories->at(i)->size;
+		}
+	}
+	a.queryCache.assign(names.size(), nullptr);
 }
 
+// memory the vertex index and the distance fields of all workers may take
+const size_t vertexIndexBudgetMB = 256;
+
+// Preprocessing step. Builds the vertex index, with cells a quarter of the median query delta wide.
+// Half of the budget is for the distance fields of the workers, which may make the cells wider.
+// When the cells of all vertices do not fit in the other half, the vertices of the finest
+// simplification that fits are indexed instead.
+inline void buildVertexIndex(AlgoData &a) {
+	double medianDelta = medianQueryDelta(a);
+	BoundingBox &box = *a.boundingBox;
+	double area = (box.maxx - box.minx) * (box.maxy - box.miny);
+	if (!(medianDelta > 0) || !(area > 0)) return;
+	size_t budget = vertexIndexBudgetMB * 1024 * 1024;
+	double maxCells = budget / 2.0 / (a.numWorkers * (sizeof(double) + sizeof(int)));
+	double cellSize = std::max(medianDelta / 4, sqrt(area / maxCells) * 1.01);
+	VertexIndex *index = new VertexIndex();
+	for (int level = -1; level < numSimplifications; level++) {
+		// -1 is all vertices, then from the finest simplification to the coarsest
+		int l = level < 0 ? -1 : numSimplifications - 1 - level;
+		if (index->build(*a.trajectories, box, cellSize, l, budget - a.numWorkers * index->fieldBytes())) {
+			a.vertexIndex = index;
+			return;
+		}
+	}
+	// does not fit in the budget, see printFilterStats
+	delete index;
+}
 
+// Builds the simplifications a query trajectory needs, allocated from arena
+inline void makeQuerySimplifications(AlgoData &a, Trajectory &queryTrajectory, AlgorithmObjects &algo, Arena &arena) {
+	double diagonal = queryTrajectory.boundingBox.getDiagonal();
+	makeSourceSimplificationsForTrajectory(a, queryTrajectory, queryTrajectory, diagonal, algo, numSimplifications, arena);
+	// for query trajectories, we also simplify the simplifications. Not because we use them directly, but because
+	// we use their freespace jumps
+	for (int i = 1; i < numSimplifications; i++) {
+		makeSourceSimplificationsForTrajectory(a, *queryTrajectory.simplifications[i], queryTrajectory, diagonal, algo, i-1, arena);
+	}
+}
 
+// deletes a (query) trajectory and its (nested) simplifications, the arena data is not freed
+inline void deleteQueryTrajectory(Trajectory *queryTrajectory) {
+	// TODO: cleanup queryTrajectory, doesn't work from destructor somehow
+	for (int i = 0; i < queryTrajectory->simplifications.size(); i++) {
+		Trajectory *s = queryTrajectory->simplifications[i];
+		for (int j = 0; j < s->simplifications.size(); j++) {
+			delete s->simplifications[j];
+		}
+		delete queryTrajectory->simplifications[i];
+	}
+	delete queryTrajectory;
+}
 
+// Returns the query trajectory in filename with its query-side simplifications.
+// If the trajectory is in the dataset, its vertices are reused and the result is cached
+// for later queries (cached = true, must not be deleted). Otherwise it is loaded into
+// algo->queryArena and must be deleted by the caller.
+inline Trajectory* getQueryTrajectory(AlgoData *a, std::string &filename, AlgorithmObjects *algo, bool &cached) {
+	auto found = a->datasetIndex.find(filename);
+	if (found == a->datasetIndex.end()) {
+		cached = false;
+		Trajectory *queryTrajectory = algo->fio.parseTrajectoryFile(filename, -1, algo->queryArena);
+		makeQuerySimplifications(*a, *queryTrajectory, *algo, algo->queryArena);
+		return queryTrajectory;
+	}
+	cached = true;
+	int index = found->second;
+	a->queryCacheMtx.lock();
+	Trajectory *queryTrajectory = a->queryCache[index];
+	a->queryCacheMtx.unlock();
+	if (queryTrajectory != nullptr) {
+		return queryTrajectory;
+	}
+
+	// built outside the lock, if another worker was faster its version is kept
+	Trajectory *built = new Trajectory();
+	built->viewOf(*a->trajectories->at(index));
+	built->uniqueIDInDataset = -1;
+	makeQuerySimplifications(*a, *built, *algo, *algo->arena);
+	a->queryCacheMtx.lock();
+	if (a->queryCache[index] == nullptr) {
+		a->queryCache[index] = built;
+	}
+	queryTrajectory = a->queryCache[index];
+	a->queryCacheMtx.unlock();
+	if (queryTrajectory != built) {
+		deleteQueryTrajectory(built);
+	}
+	return queryTrajectory;
+}
+
+
+// Estimates the work of a query group before solving it: the number of vertices of all candidates of the
+// range query with the largest delta, times the number of query vertices. Query trajectories that are not in
+// the dataset are not parsed, only their endpoints are read.
+inline double estimateGroupCost(AlgoData *a, QueryGroup &group, FileIO &fio) {
+	Vertex start;
+	Vertex end;
+	int querySize;
+	auto found = a->datasetIndex.find(group.queryTrajectoryFilename);
+	if (found != a->datasetIndex.end()) {
+		Trajectory *t = a->trajectories->at(found->second);
+		start = t->vertices[0];
+		end = t->vertices[t->size - 1];
+		querySize = t->size;
+	}
+	else if (!fio.peekTrajectoryFile(group.queryTrajectoryFilename, start, end, querySize)) {
+		return 0;
+	}
+	if (group.queries[0]->knn > 0) {
+		// no range to count candidates in, assume the worst case
+		return a->datasetVertices * querySize;
+	}
+	double delta = group.queries.back()->queryDelta;
+	double candidateVertices = 0;
+	const std::function< void(Trajectory*) >& count = [&](Trajectory *t) -> void {
+		candidateVertices += t->size;
+	};
+#if USE_ENDPOINT_INDEX
+	a->endpointIndex->neighborsWithCallback(start, end, delta, *a->trajectories, count);
+#else
+	a->diHash->neighborsWithCallback(start, end, delta, *a->trajectories, count);
+#endif
+	return candidateVertices * querySize;
+}
 
 
 // runtime steps ---------------------------------------------------------------------
 
-// to reduce bookkeeping time, and to increase memory locality, we use 
-// all pruning step on a single trajectory pair before considering another,
-// we implement this by giving each pruning step emittor functions indicating
-// success, failure and unknown results
+// Candidates are decided in batches. Every pruning step is a stage that runs over a whole
+// batch of probes (candidate, query) and splits it into YES, NO and MAYBE, only the MAYBE
+// probes go on to the next stage. Running one stage at a time keeps its code and the
+// query data it uses in cache.
 
 // Query step. Does rangequeries for start/endpoints of dataset. Adds all found trajectories
 // to candidates.
-void collectDiHashPoints(AlgoData *a, Query &q, AlgorithmObjects *algo, Trajectory &queryTrajectory, const std::function< void(Trajectory*) >& emit) {
+inline void collectDiHashPoints(AlgoData *a, Query &q, Trajectory &queryTrajectory, const std::function< void(Trajectory*) >& emit) {
 	Vertex start = queryTrajectory.vertices[0];
 	Vertex end = queryTrajectory.vertices[queryTrajectory.size - 1];
 
+#if USE_ENDPOINT_INDEX
+	a->endpointIndex->neighborsWithCallback(start, end, q.queryDelta, *a->trajectories, emit);
+#else
 	a->diHash->neighborsWithCallback(start, end, q.queryDelta, *a->trajectories, [&](Trajectory* t) -> void{
 		emit(t);
 	});
+#endif
+}
+
+
+// true if the endpoints of t are strictly within delta of the query endpoints, the same test the endpoint range query does
+inline bool endpointsWithin(Trajectory &queryTrajectory, Trajectory *t, double delta) {
+	double deltaSQ = delta * delta;
+	Vertex &qs = queryTrajectory.vertices[0];
+	Vertex &ts = t->vertices[0];
+	double dx = qs.x - ts.x;
+	double dy = qs.y - ts.y;
+	if (dx * dx + dy * dy >= deltaSQ) return false;
+	Vertex &qe = queryTrajectory.vertices[queryTrajectory.size - 1];
+	Vertex &te = t->vertices[t->size - 1];
+	dx = qe.x - te.x;
+	dy = qe.y - te.y;
+	return dx * dx + dy * dy < deltaSQ;
+}
+
+// Query step. Probes with a smaller delta than the range query was done with are checked with the
+// same endpoint test, if the endpoints of t are not strictly within delta it is not a result.
+inline Decision pruneWithEndpoints(Trajectory &queryTrajectory, CandidateProbe &p) {
+	return endpointsWithin(queryTrajectory, p.t, p.q->queryDelta) ? MAYBE : DECIDED_NO;
+}
+
+// Query step. Removes the candidates with a vertex further than delta from the query trajectory,
+// according to the vertex index. Does nothing without vertex index, or when the query touches
+// too many of its cells.
+inline void pruneWithVertexIndex(AlgoData *a, AlgorithmObjects *algo, Trajectory &queryTrajectory, double delta, std::vector<Trajectory*> &candidates) {
+	if (a->vertexIndex == nullptr || candidates.empty()) return;
+	a->vertexIndex->fill(algo->vertexField, queryTrajectory, delta);
+	if (!algo->vertexField.valid) return;
+	int kept = 0;
+	for (Trajectory *t : candidates) {
+		if (a->vertexIndex->lowerBound(algo->vertexField, t->uniqueIDInDataset) <= delta) {
+			candidates[kept++] = t;
+		}
+	}
+	algo->filteredVertices += candidates.size() - kept;
+	candidates.resize(kept);
+}
+
+// Lower bound for the frechet distance from the bounding boxes alone. Every side of a bounding
+// box is touched by a vertex, which is matched to some point inside the other bounding box.
+inline double boundingBoxBound(BoundingBox &a, BoundingBox &b) {
+	double bound = std::max(std::max(a.minx - b.minx, b.maxx - a.maxx), std::max(a.miny - b.miny, b.maxy - a.maxy));
+	bound = std::max(bound, std::max(std::max(b.minx - a.minx, a.maxx - b.maxx), std::max(b.miny - a.miny, a.maxy - b.maxy)));
+	return std::max(0.0, bound);
+}
+
+// Query step. Rejects t when the bounding boxes alone show it is further than delta away.
+inline Decision pruneWithBoundingBox(AlgorithmObjects *algo, Trajectory &queryTrajectory, CandidateProbe &p) {
+	if (boundingBoxBound(queryTrajectory.boundingBox, p.t->boundingBox) > p.q->queryDelta) {
+		algo->filteredBoundingBox++;
+		return DECIDED_NO;
+	}
+	return MAYBE;
+}
+
+// Number of interior vertices sampled per trajectory by pruneWithSampledVertices
+const int filterSamples = 8;
+
+// true if one of the sampled vertices of a is further than delta from the bounding box of b
+inline bool sampleOutside(Trajectory &a, Trajectory &b, double deltaSQ) {
+	int n = std::min(filterSamples, a.size - 2);
+	for (int k = 1; k <= n; k++) {
+		Vertex &v = a.vertices[(long)k * (a.size - 1) / (n + 1)];
+		if (b.boundingBox.distanceSQ(v.x, v.y) > deltaSQ) {
+			return true;
+		}
+	}
+	return false;
 }
 
+// Query step. Every vertex is matched to a point of the other trajectory, so a vertex further than
+// delta from the bounding box of the other trajectory rejects t. Only a few vertices are sampled.
+inline Decision pruneWithSampledVertices(AlgorithmObjects *algo, Trajectory &queryTrajectory, CandidateProbe &p) {
+	double deltaSQ = p.q->queryDelta * p.q->queryDelta;
+	if (sampleOutside(queryTrajectory, *p.t, deltaSQ) || sampleOutside(*p.t, queryTrajectory, deltaSQ)) {
+		algo->filteredSamples++;
+		return DECIDED_NO;
+	}
+	return MAYBE;
+}
 
 // Query step. For each trajectory T in the dataset and query trajectory Q, this step
-// compares successive simplifications of T and Q with continuous decision frechet.
-// Each comparison can result in YES, NO, or MAYBE.
+// compares simplification i of T and Q with continuous decision frechet. It is run for
+// successive simplifications, each comparison can result in YES, NO, or MAYBE.
 // YES   -> remove from candidates, add to results
 // NO    -> remove from candidates
 // MAYBE -> try next simplification, if none are left, continue to next algorithm step
-void pruneWithSimplifications(AlgoData *a, Query &q, AlgorithmObjects *algo, Trajectory &queryTrajectory, Trajectory *t, 
-	const std::function< void(Trajectory*) >& maybe, const std::function< void(Trajectory*) >& result) {
-	bool broke = false;
-	for (int i = 0; i < numSimplifications; i++) {
-
-		// construct epsilons for tri ineq.
-		double decisionEpsilonLower = q.queryDelta
-			- queryTrajectory.simplifications[i]->simplificationEpsilon
-			- t->simplifications[i]->simplificationEpsilon;
-
-		double decisionEpsilonUpper = q.queryDelta
-			+ queryTrajectory.simplifications[i]->simplificationEpsilon
-			+ t->simplifications[i]->simplificationEpsilon;
-
-		double dist = equalTimeDistance(*t->simplifications[i], *queryTrajectory.simplifications[i]);
-
-		// do ETD greedy check
-		if (dist < decisionEpsilonLower) {
-			result(t);
-			broke = true;
-			break;
-		}
+inline Decision pruneWithSimplification(AlgorithmObjects *algo, Trajectory &queryTrajectory, int i, CandidateProbe &p) {
+	Trajectory *t = p.t;
+	Query &q = *p.q;
 
-		// do lower frechet check
-		if (decisionEpsilonLower > 0) {
-			bool r = algo->cdfqs.calculate(*queryTrajectory.simplifications[i], *t->simplifications[i], decisionEpsilonLower, q.queryDelta);
-			if (r) {
-				result(t);
-				broke = true;
-				break;
-			}
-		}
+	// construct epsilons for tri ineq.
+	double decisionEpsilonLower = q.queryDelta
+		- queryTrajectory.simplifications[i]->simplificationEpsilon
+		- t->simplifications[i]->simplificationEpsilon;
 
-		// do upper frechet check
-		if (decisionEpsilonUpper > 0) {
-			bool r = algo->cdfqs.calculate(*queryTrajectory.simplifications[i], *t->simplifications[i], decisionEpsilonUpper, q.queryDelta);
-			if (!r) {
-				broke = true;
-				break;
-			}
+	double decisionEpsilonUpper = q.queryDelta
+		+ queryTrajectory.simplifications[i]->simplificationEpsilon
+		+ t->simplifications[i]->simplificationEpsilon;
+
+	double dist = equalTimeDistance(*t->simplifications[i], *queryTrajectory.simplifications[i]);
+
+	// do ETD greedy check
+	if (dist < decisionEpsilonLower) {
+		return DECIDED_YES;
+	}
+
+#if USE_DUAL_DECISION
+	// lower and upper frechet check in one sweep
+	CDFQDual::Result r = algo->cdfqd.calculate(*queryTrajectory.simplifications[i], *t->simplifications[i], decisionEpsilonLower, decisionEpsilonUpper);
+	if (r.low) {
+		return DECIDED_YES;
+	}
+	if (!r.high) {
+		return DECIDED_NO;
+	}
+	return MAYBE;
+#else
+	// do lower frechet check
+	if (decisionEpsilonLower > 0) {
+		bool r = algo->cdfqs.calculate(*queryTrajectory.simplifications[i], *t->simplifications[i], decisionEpsilonLower, q.queryDelta);
+		if (r) {
+			return DECIDED_YES;
 		}
 	}
-	if (!broke) {
-		maybe(t);
+
+	// do upper frechet check
+	if (decisionEpsilonUpper > 0) {
+		bool r = algo->cdfqs.calculate(*queryTrajectory.simplifications[i], *t->simplifications[i], decisionEpsilonUpper, q.queryDelta);
+		if (!r) {
+			return DECIDED_NO;
+		}
 	}
+	return MAYBE;
+#endif
 }
 
 // Query step. Uses equal time distance as an upperbound for the actual frechet distance
 // If ETD(P, Q) <= queryDelta then CDF(P,Q) <= queryDelta. With P in dataset and Q query trajectory.
-void pruneWithEqualTime(AlgoData *a, Query &q, AlgorithmObjects *algo, Trajectory &queryTrajectory, Trajectory *t,
-	const std::function< void(Trajectory*) >& maybe, const std::function< void(Trajectory*) >& result) {
-	double dist = equalTimeDistance(*t, queryTrajectory);
-	if (dist < q.queryDelta) {
-		result(t);
+inline Decision pruneWithEqualTime(Trajectory &queryTrajectory, CandidateProbe &p) {
+	double dist = equalTimeDistance(*p.t, queryTrajectory);
+	return dist < p.q->queryDelta ? DECIDED_YES : MAYBE;
+}
+
+// Pairs with a smaller full resolution diagram are decided without corridor
+const int corridorMinCells = 4096;
+
+// Maps the region of the last simplification level that is reachable for the upper tri. ineq. epsilon
+// onto the full resolution diagram of queryTrajectory (rows) and t (columns), through the sourceIndex
+// of the simplifications. The region is widened by one simplified row and column on every side.
+// Fills algo->corridorLow/High per full column, returns false if there is no corridor.
+inline bool buildCorridor(AlgorithmObjects *algo, Trajectory &queryTrajectory, Trajectory *t, double delta) {
+	int level = numSimplifications - 1;
+	TrajectorySimplification &ps = *queryTrajectory.simplifications[level];
+	TrajectorySimplification &ts = *t->simplifications[level];
+	if (ps.sourceIndex.size() != ps.size || ts.sourceIndex.size() != ts.size) {
+		// no mapping to the source trajectory
+		return false;
 	}
-	else {
-		maybe(t);
+	double upper = delta + ps.simplificationEpsilon + ts.simplificationEpsilon;
+	int simpColumns = ts.size - 1;
+	std::vector<int> &visitedLow = algo->visitedLow;
+	std::vector<int> &visitedHigh = algo->visitedHigh;
+	visitedLow.resize(simpColumns);
+	visitedHigh.resize(simpColumns);
+	if (!algo->cdfqd.calculate(ps, ts, 0, upper, nullptr, nullptr, visitedLow.data(), visitedHigh.data()).high) {
+		return false;
 	}
-}
 
+	int columns = t->size - 1;
+	std::vector<int> &corridorLow = algo->corridorLow;
+	std::vector<int> &corridorHigh = algo->corridorHigh;
+	corridorLow.assign(columns, queryTrajectory.size);
+	corridorHigh.assign(columns, -1);
+	for (int j = 0; j < simpColumns; j++) {
+		int low = ps.size;
+		int high = -1;
+		for (int k = std::max(0, j - 1); k <= std::min(simpColumns - 1, j + 1); k++) {
+			if (visitedLow[k] < 0) continue;
+			low = std::min(low, visitedLow[k]);
+			high = std::max(high, visitedHigh[k]);
+		}
+		if (high < 0) continue;
+		low = std::max(0, low - 1);
+		high = std::min(ps.size - 2, high + 1);
+		// simplified row r covers the full rows from sourceIndex[r] up to sourceIndex[r + 1]
+		int fullLow = ps.sourceIndex[low];
+		int fullHigh = ps.sourceIndex[high + 1] - 1;
+		for (int c = ts.sourceIndex[j]; c < ts.sourceIndex[j + 1]; c++) {
+			corridorLow[c] = std::min(corridorLow[c], fullLow);
+			corridorHigh[c] = std::max(corridorHigh[c], fullHigh);
+		}
+	}
+	return true;
+}
 
 // Query step. The final step for each query is to do a full decision frechet computation.
 // This step contains no additional smart optimization, and so is very slow.
-void pruneWithDecisionFrechet(AlgoData *a, Query &q, AlgorithmObjects *algo, Trajectory &queryTrajectory, Trajectory *t,
-	const std::function< void(Trajectory*) >& result) {
-	bool r = algo->cdfqs.calculate(queryTrajectory, *t, q.queryDelta);
-	if (r) {
-		result(t);
+inline Decision pruneWithDecisionFrechet(AlgorithmObjects *algo, Trajectory &queryTrajectory, CandidateProbe &p) {
+#if USE_CORRIDOR_DECISION
+	// a path inside the corridor is a path in the whole diagram, only without one the whole diagram is searched
+	if ((double)queryTrajectory.size * p.t->size >= corridorMinCells && buildCorridor(algo, queryTrajectory, p.t, p.q->queryDelta)) {
+		CDFQDual::Result corridor = algo->cdfqd.calculate(queryTrajectory, *p.t, 0, p.q->queryDelta, algo->corridorLow.data(), algo->corridorHigh.data());
+		if (corridor.high) {
+			return DECIDED_YES;
+		}
 	}
+#endif
+	bool r = algo->cdfqs.calculate(queryTrajectory, *p.t, p.q->queryDelta);
 	// last step, conclusive, no maybe
-}
\ No newline at end of file
+	return r ? DECIDED_YES : DECIDED_NO;
+}
+
+// Runs all pruning steps after the range query over a batch, every probe ends up in yes or no
+inline void runPruningStages(AlgorithmObjects *algo, Trajectory &queryTrajectory, CandidateBatch &batch, CandidateBatch &yes, CandidateBatch &no) {
+	runStage(batch, yes, no, [&](CandidateProbe &p) -> Decision {
+		return pruneWithEndpoints(queryTrajectory, p);
+	});
+#if USE_BBOX_FILTER
+	runStage(batch, yes, no, [&](CandidateProbe &p) -> Decision {
+		return pruneWithBoundingBox(algo, queryTrajectory, p);
+	});
+#endif
+#if USE_SAMPLE_FILTER
+	runStage(batch, yes, no, [&](CandidateProbe &p) -> Decision {
+		return pruneWithSampledVertices(algo, queryTrajectory, p);
+	});
+#endif
+	for (int i = 0; i < numSimplifications && !batch.empty(); i++) {
+		runStage(batch, yes, no, [&](CandidateProbe &p) -> Decision {
+			return pruneWithSimplification(algo, queryTrajectory, i, p);
+		});
+	}
+	runStage(batch, yes, no, [&](CandidateProbe &p) -> Decision {
+		return pruneWithEqualTime(queryTrajectory, p);
+	});
+	runStage(batch, yes, no, [&](CandidateProbe &p) -> Decision {
+		return pruneWithDecisionFrechet(algo, queryTrajectory, p);
+	});
+}
+
+// Query step for all queries of a group. The answer is monotone in delta: YES at some delta means YES
+// for every larger delta, NO means NO for every smaller delta. So a candidate is decided for the whole
+// (sorted) delta vector by bisection, where every bisection round is one batch through the pruning stages.
+// Sets firstResult[c] to the index of the first query candidate c is a result of, or the number of queries
+// if it is not a result of any of them.
+inline void decideCandidatesForGroup(QueryGroup &group, AlgorithmObjects *algo, Trajectory &queryTrajectory, Trajectory **candidates, int count, int *firstResult) {
+	// all queries before lo are NO, all queries from hi on are YES
+	std::vector<int> &lo = algo->bisectLow;
+	std::vector<int> &hi = algo->bisectHigh;
+	lo.assign(count, 0);
+	hi.assign(count, group.queries.size());
+	CandidateBatch &batch = algo->batch;
+	CandidateBatch &yes = algo->yes;
+	CandidateBatch &no = algo->no;
+	while (true) {
+		batch.clear();
+		yes.clear();
+		no.clear();
+		for (int c = 0; c < count; c++) {
+			if (lo[c] < hi[c]) {
+				int mid = (lo[c] + hi[c]) / 2;
+				batch.push_back({ candidates[c], group.queries[mid], c });
+			}
+		}
+		if (batch.empty()) break;
+		runPruningStages(algo, queryTrajectory, batch, yes, no);
+		for (CandidateProbe &p : yes) {
+			hi[p.candidate] = (lo[p.candidate] + hi[p.candidate]) / 2;
+		}
+		for (CandidateProbe &p : no) {
+			lo[p.candidate] = (lo[p.candidate] + hi[p.candidate]) / 2 + 1;
+		}
+	}
+	for (int c = 0; c < count; c++) {
+		firstResult[c] = lo[c];
+	}
+}
+
+// Lower bound for the frechet distance: the largest of the start and end point distances, squared
+inline double endpointBoundSQ(Trajectory &queryTrajectory, Trajectory *t) {
+	double start = distSQ(queryTrajectory.vertices[0], t->vertices[0]);
+	double end = distSQ(queryTrajectory.vertices[queryTrajectory.size - 1], t->vertices[t->size - 1]);
+	return std::max(start, end);
+}
+
+// Runs the pruning stages after the range query on a single probe, stopping at the first conclusive
+// one, but without the full decision
+inline Decision filterProbe(AlgorithmObjects *algo, Trajectory &queryTrajectory, CandidateProbe &p) {
+	Decision d = pruneWithEndpoints(queryTrajectory, p);
+#if USE_BBOX_FILTER
+	if (d == MAYBE) {
+		d = pruneWithBoundingBox(algo, queryTrajectory, p);
+	}
+#endif
+#if USE_SAMPLE_FILTER
+	if (d == MAYBE) {
+		d = pruneWithSampledVertices(algo, queryTrajectory, p);
+	}
+#endif
+	for (int i = 0; i < numSimplifications && d == MAYBE; i++) {
+		d = pruneWithSimplification(algo, queryTrajectory, i, p);
+	}
+	if (d == MAYBE) {
+		d = pruneWithEqualTime(queryTrajectory, p);
+	}
+	return d;
+}
+
+// Query step for k nearest neighbour queries. Candidates are collected from the range query in rings of
+// doubling radius, and handled in order of their endpoint distance. Once k trajectories are found, the
+// k-th distance is the threshold: the filters of the range queries are run with that threshold, and only
+// candidates that are not rejected get their exact frechet distance computed. The search stops when the
+// threshold is below the radius of the ring, since every trajectory not seen yet has an endpoint further away.
+// nearest is set to the k (distance, trajectory) pairs, by increasing distance.
+inline void solveKnnQuery(AlgoData *a, Query &q, AlgorithmObjects *algo, Trajectory &queryTrajectory, std::vector<std::pair<double, Trajectory*>> &nearest) {
+	// max-heap on distance, the top is the threshold once there are k
+	nearest.clear();
+	// orders by distance, ties by dataset order
+	auto closer = [](const std::pair<double, Trajectory*> &l, const std::pair<double, Trajectory*> &r) -> bool {
+		return l.first < r.first || (l.first == r.first && l.second->uniqueIDInDataset < r.second->uniqueIDInDataset);
+	};
+	double threshold = INFINITY;
+
+	// no dataset trajectory is further away than this
+	BoundingBox box = *a->boundingBox;
+	box.addPoint(queryTrajectory.boundingBox.minx, queryTrajectory.boundingBox.miny);
+	box.addPoint(queryTrajectory.boundingBox.maxx, queryTrajectory.boundingBox.maxy);
+	double maxRadius = box.getDiagonal() * 2 + 1;
+	double radius = box.getDiagonal() / 1024 + 1e-9;
+	double previousRadiusSQ = -1;
+
+	Query thresholdQuery = q;
+	std::vector<std::pair<double, Trajectory*>> &ring = algo->ring;
+	while (true) {
+		double radiusSQ = radius * radius;
+		// the candidates not seen in earlier rings, by increasing endpoint distance
+		ring.clear();
+		Query ringQuery = q;
+		ringQuery.queryDelta = radius;
+		collectDiHashPoints(a, ringQuery, queryTrajectory, [&](Trajectory *t) -> void {
+			double boundSQ = endpointBoundSQ(queryTrajectory, t);
+			if (boundSQ >= previousRadiusSQ) {
+				ring.push_back({ boundSQ, t });
+			}
+		});
+		std::sort(ring.begin(), ring.end(), closer);
+
+		for (std::pair<double, Trajectory*> &c : ring) {
+			double bound = sqrt(c.first);
+			Trajectory *t = c.second;
+			if (nearest.size() == q.knn && bound >= threshold) {
+				// all following candidates are further away
+				break;
+			}
+			double upper = INFINITY;
+			if (nearest.size() == q.knn) {
+				// only candidates the filters cannot reject with the current threshold
+				thresholdQuery.queryDelta = threshold;
+				CandidateProbe p = { t, &thresholdQuery, 0 };
+				if (filterProbe(algo, queryTrajectory, p) == DECIDED_NO) {
+					continue;
+				}
+				upper = threshold;
+			}
+			// the equal time distance is an upper bound, made a bit larger to stay one under rounding
+			upper = std::min(upper, equalTimeDistance(*t, queryTrajectory) * (1 + 1e-9));
+			double distance = algo->frechetDistance.calculate(queryTrajectory, *t, bound, upper);
+			if (distance == INFINITY) {
+				continue;
+			}
+			std::pair<double, Trajectory*> found = { distance, t };
+			if (nearest.size() < q.knn) {
+				nearest.push_back(found);
+				std::push_heap(nearest.begin(), nearest.end(), closer);
+			}
+			else if (closer(found, nearest.front())) {
+				std::pop_heap(nearest.begin(), nearest.end(), closer);
+				nearest.back() = found;
+				std::push_heap(nearest.begin(), nearest.end(), closer);
+			}
+			if (nearest.size() == q.knn) {
+				threshold = nearest.front().first;
+			}
+		}
+
+		if ((nearest.size() == q.knn && threshold <= radius) || radius >= maxRadius) {
+			break;
+		}
+		previousRadiusSQ = radiusSQ;
+		radius *= 2;
+	}
+	std::sort_heap(nearest.begin(), nearest.end(), closer);
+}
@@ -6,9 +6,16 @@
 #include "AgarwalProg.h"
 #include "EqualTimeDistance.h"
 #include "DiHash.h"
+#include "EndpointIndex.h"
+#include "VertexIndex.h"
 #include "Query.h"
 #include "CDFQueued.h"
 #include "CDFQShortcuts.h"
+#include "CDFQDual.h"
+#include "FrechetDistance.h"
+#include "QueryScheduler.h"
+#include "CandidateBatch.h"
+#include "ResultWriter.h"
 #include "settings.h"
 
 
@@ -18,19 +25,66 @@
 #include <sstream>
 #include <iomanip>
 #include <iostream>
+#include <unordered_map>
+#include <atomic>
 
 
+// number of simplification steps constructed for each trajectory
+const int numSimplifications = 4;
+
 // All data needed by the algorithm to solve a specific query file
 // Also contains structures needed for preprocessing
+class QueryPrefetcher;
+
 struct AlgoData {
 	std::vector<Query> *queries;
-	std::vector<Trajectory*> *trajectories;
+	std::vector<QueryGroup> queryGroups;// queries grouped by query trajectory
+	std::vector<Trajectory*> *trajectories = nullptr;
+	// dataset trajectories given in memory instead of as files, see FrechetIndex
+	const std::vector<std::vector<Vertex>> *datasetPoints = nullptr;
 	std::vector<std::string> *trajectoryNames;
 	int numTrajectories;
-	DiHash* diHash;
+	DiHash* diHash = nullptr;
+	EndpointIndex* endpointIndex = nullptr;
 	FileIO fio;
 	BoundingBox* boundingBox;
-	volatile int startedSolving = 0;
+	// grid resolution of the DiHash, 0 -> chosen by chooseSlotsPerDimension
+	int slotsPerDimension = 0;
+	// simplification epsilons relative to the bounding box diagonal, summed over the learnedCount
+	// simplified dataset trajectories. Query trajectories are simplified with the averages.
+	double avgsBBRatio[numSimplifications] = {};
+	int learnedCount = 0;
+	// arenas holding the data of all dataset trajectories
+	std::vector<Arena*> arenas;
+	// index snapshot the dataset trajectories point into, if loaded from one
+	class MappedFile *snapshot = nullptr;
+	std::string loadIndexFile;// non-empty -> load preprocessed state from this snapshot
+	std::string saveIndexFile;// non-empty -> save preprocessed state to this snapshot
+	// dataset index of every trajectory name, used to reuse dataset trajectories as queries
+	std::unordered_map<std::string, int> datasetIndex;
+	double datasetVertices = 0;// total number of vertices of the dataset trajectories
+	// query versions of dataset trajectories (with query-side simplifications), built on first use
+	std::vector<Trajectory*> queryCache;
+	std::mutex queryCacheMtx;
+	QueryScheduler scheduler;
+	// self join mode, used instead of the queries when joinDelta > 0
+	double joinDelta = 0;
+	std::string joinOutputFile = "join-result.txt";
+	std::atomic<int> joinNext{ 0 };
+	// candidates rejected by the cheap filters, summed over the workers
+	std::atomic<long> filteredBoundingBox{ 0 };
+	std::atomic<long> filteredSamples{ 0 };
+	std::atomic<long> filteredVertices{ 0 };
+	// optional, see USE_VERTEX_INDEX
+	VertexIndex *vertexIndex = nullptr;
+	// number of query trajectories loaded ahead of the workers, 0 -> no prefetching
+	int prefetchDepth = 4;
+	QueryPrefetcher *prefetcher = nullptr;
+	// query results, see ResultWriter
+	ResultWriter resultWriter;
+	std::string resultFile = "results.txt";
+	bool perQueryResults = false;// true -> a result-XXXXX.txt file per query instead of resultFile
+	std::mutex simplificationMtx;// guards startedSimplifying
 	volatile int startedSimplifying = 0;
 	int numWorkers;
 
@@ -41,177 +95,441 @@ struct AlgoData {
 // Each thread has seperate algorithm objects so they can use
 // their own buffers to store intermediate results.
 struct AlgorithmObjects {
-	std::ostringstream results;
+	// results not yet handed to the result writer
+	ResultWriter::Buffer *results = nullptr;
+	long joinPairs = 0;
+	// candidates rejected by the cheap filters
+	long filteredBoundingBox = 0;
+	long filteredSamples = 0;
+	long filteredVertices = 0;
+	// learned simplification epsilons of the trajectories this worker simplified, see AlgoData
+	double avgsBBRatio[numSimplifications] = {};
+	int learnedCount = 0;
+	// time spent waiting for the query prefetcher
+	double prefetchWaitSec = 0;
+	VertexIndex::Field vertexField;
 	std::vector<Trajectory*> candidates;
+	// buffers of the staged candidate pipeline
+	CandidateBatch batch;
+	CandidateBatch yes;
+	CandidateBatch no;
+	std::vector<int> bisectLow;
+	std::vector<int> bisectHigh;
+	// corridor of the full resolution decision, and the region it is made from
+	std::vector<int> corridorLow;
+	std::vector<int> corridorHigh;
+	std::vector<int> visitedLow;
+	std::vector<int> visitedHigh;
+	// k nearest neighbour search
+	std::vector<std::pair<double, Trajectory*>> nearest;
+	std::vector<std::pair<double, Trajectory*>> ring;
+	FrechetDistance frechetDistance;
 	BoundingBox bbox;
 
+	// persistent allocations, owned by AlgoData
+	Arena *arena = nullptr;
+	// for simplifications that may be thrown away again
+	Arena scratchArena;
+	// for the query trajectory being solved, reset after every query
+	Arena queryArena;
+
 	FileIO fio;
 	AgarwalSimplification agarwal;
 	ProgressiveAgarwal agarwalProg;
 	CDFQueued cdfq;
 	CDFQShortcuts cdfqs;
+	CDFQDual cdfqd;
 
 };
 
 // TODO: Included here to avoid include problem
 #include "AlgoSteps.h"
-
-// Does all needed preprocessing for the given the dataset
-void preprocessDataSet(AlgoData *a) {
-	constructSimplifications(*a);
-	addPtsToDiHash(*a);
+#include "IndexSnapshot.h"
+#include "QueryPrefetch.h"
+
+// Does all needed preprocessing for the given the dataset,
+// or loads the result of an earlier run from an index snapshot
+inline void preprocessDataSet(AlgoData *a) {
+	if (!a->loadIndexFile.empty()) {
+		loadIndexSnapshot(*a, a->loadIndexFile);
+	}
+	else {
+		constructSimplifications(*a);
+		addPtsToDiHash(*a);
+		if (!a->saveIndexFile.empty()) {
+			saveIndexSnapshot(*a, a->saveIndexFile);
+		}
+	}
+	buildDatasetIndex(*a);
+#if USE_VERTEX_INDEX
+	buildVertexIndex(*a);
+#endif
 }
 
-// Solves a single query, calls functions in AlgoSteps.h
-// Before solving, also loads the query trajectory (since it may 
-// not be present in the dataset) and constructs simplifications for it.
-void solveQuery(AlgoData *a, Query &q, AlgorithmObjects *algo) {
-	Trajectory *queryTrajectory = algo->fio.parseTrajectoryFile(q.queryTrajectoryFilename, -1);
-
-
-	double diagonal = queryTrajectory->boundingBox->getDiagonal();
-	makeSourceSimplificationsForTrajectory(*queryTrajectory, *queryTrajectory, diagonal, *algo, numSimplifications);
-	// for query trajectories, we also simplify the simplifications. Not because we use them directly, but because
-	// we use their freespace jumps
-	for (int i = 1; i < numSimplifications; i++) {
-		makeSourceSimplificationsForTrajectory(*queryTrajectory->simplifications[i], *queryTrajectory, diagonal, *algo, i-1);
+// Groups the range queries by query trajectory, so every trajectory is loaded, simplified
+// and range queried once. Groups keep the order of their first query in the file.
+// Every k nearest neighbour query gets a group of its own.
+inline void planQueries(AlgoData *a) {
+	std::unordered_map<std::string, int> groupOf;
+	a->queryGroups.clear();
+	for (Query &q : *a->queries) {
+		if (q.knn > 0) {
+			a->queryGroups.emplace_back();
+			a->queryGroups.back().queryTrajectoryFilename = q.queryTrajectoryFilename;
+			a->queryGroups.back().queries.push_back(&q);
+			continue;
+		}
+		auto found = groupOf.find(q.queryTrajectoryFilename);
+		if (found == groupOf.end()) {
+			found = groupOf.emplace(q.queryTrajectoryFilename, a->queryGroups.size()).first;
+			a->queryGroups.emplace_back();
+			a->queryGroups.back().queryTrajectoryFilename = q.queryTrajectoryFilename;
+		}
+		a->queryGroups[found->second].queries.push_back(&q);
 	}
+	for (QueryGroup &g : a->queryGroups) {
+		std::stable_sort(g.queries.begin(), g.queries.end(), [](Query *l, Query *r) -> bool {
+			return l->queryDelta < r->queryDelta;
+		});
+	}
+}
 
+// Number of candidates in one chunk of work other workers can help with, also the batch size of the pruning stages
+const int intraQueryChunkSize = 64;
+
+// Gets the query trajectory of a group, from the prefetcher when it has loaded it (prefetched = true),
+// otherwise see getQueryTrajectory
+inline Trajectory* acquireQueryTrajectory(AlgoData *a, QueryGroup &group, AlgorithmObjects *algo, bool &cached, bool &prefetched) {
+	prefetched = false;
+	if (a->prefetcher != nullptr && a->datasetIndex.count(group.queryTrajectoryFilename) == 0) {
+		Trajectory *queryTrajectory = a->prefetcher->take(&group, algo->prefetchWaitSec);
+		if (queryTrajectory != nullptr) {
+			prefetched = true;
+			cached = true;
+			return queryTrajectory;
+		}
+	}
+	return getQueryTrajectory(a, group.queryTrajectoryFilename, algo, cached);
+}
 
-
-#if WRITE_OUTPUT_TO_QUERY 
-	std::ostringstream stringStream;
-	stringStream << "result-" << std::setfill('0') << std::setw(5) << q.queryNumber << ".txt";
-	std::string filename = stringStream.str();
-	std::ofstream outfile(filename);
-
-	if (!outfile.is_open()) {
-		std::cout << "Failed to open: " << filename << "\n";
-		exit(1);
+// Gives back the query trajectory of a group once it is solved
+inline void releaseQueryTrajectory(AlgoData *a, QueryGroup &group, AlgorithmObjects *algo, Trajectory *queryTrajectory, bool cached, bool prefetched) {
+	if (prefetched) {
+		a->prefetcher->release(&group);
 	}
-#endif
+	else if (!cached) {
+		deleteQueryTrajectory(queryTrajectory);
+		algo->queryArena.reset();
+	}
+}
 
-	// statistics
-	int results = 0;
-	int dihash = 0;
-	int simp = 0;
-	int et = 0;
+// Solves all queries of a group on its query trajectory, calls functions in AlgoSteps.h.
+// results[i] are the results of range query i, a k nearest neighbour group leaves its
+// results in algo->nearest instead.
+inline void solveGroupOn(AlgoData *a, QueryGroup &group, AlgorithmObjects *algo, Trajectory *queryTrajectory, std::vector<std::vector<Trajectory*>> &results) {
+	int numQueries = group.queries.size();
 
-	const std::function< void(Trajectory*) >& result = [&](Trajectory *t) -> void{
-		results++;
-#if WRITE_OUTPUT_TO_QUERY 
-		outfile << t->name << "\n";
-#endif
-	};
+	if (group.queries[0]->knn > 0) {
+		solveKnnQuery(a, *group.queries[0], algo, *queryTrajectory, algo->nearest);
+		return;
+	}
 
-	// the actual pruning steps of the algorithm
-	collectDiHashPoints(a, q, algo, *queryTrajectory, [&](Trajectory *t) -> void {
-	//for (Trajectory *t : *a->trajectories) {
-		dihash++;
-		pruneWithSimplifications(a, q, algo, *queryTrajectory, t, [&](Trajectory *t) -> void {
-			simp++;
-			pruneWithEqualTime(a, q, algo, *queryTrajectory, t, [&](Trajectory *t) -> void {
-				et++;
-				pruneWithDecisionFrechet(a, q, algo, *queryTrajectory, t, result);
-			}, result);
-		}, result);
-	//}
+	// the range query is done once, with the largest delta. Candidates of smaller deltas are a subset.
+	std::vector<Trajectory*> &candidates = algo->candidates;
+	candidates.clear();
+	Query &largest = *group.queries[numQueries - 1];
+	collectDiHashPoints(a, largest, *queryTrajectory, [&](Trajectory *t) -> void {
+		candidates.push_back(t);
 	});
-
-#if WRITE_OUTPUT_TO_QUERY 
-	outfile.close();
+	pruneWithVertexIndex(a, algo, *queryTrajectory, largest.queryDelta, candidates);
+
+	// index of the first query each candidate is a result of
+	std::vector<int> firstResult(candidates.size());
+	int numChunks = (candidates.size() + intraQueryChunkSize - 1) / intraQueryChunkSize;
+	auto decideChunk = [&](int chunk, AlgorithmObjects *worker) -> void {
+		int first = chunk * intraQueryChunkSize;
+		int count = std::min((int)candidates.size() - first, intraQueryChunkSize);
+		decideCandidatesForGroup(group, worker, *queryTrajectory, &candidates[first], count, &firstResult[first]);
+	};
+#if USE_INTRA_QUERY_PARALLEL
+	if (a->numWorkers > 1 && numChunks > 1) {
+		// idle workers can decide chunks of candidates with their own buffers
+		SharedJob job;
+		job.numChunks = numChunks;
+		job.run = decideChunk;
+		a->scheduler.runShared(&job, algo);
+	}
+	else
 #endif
+	{
+		for (int chunk = 0; chunk < numChunks; chunk++) {
+			decideChunk(chunk, algo);
+		}
+	}
 
-	// TODO: cleanup queryTrajectory, doesn't work from destructor somehow
-	for (int i = 0; i < queryTrajectory->simplifications.size(); i++) {
-		Trajectory *s = queryTrajectory->simplifications[i];
-		for (int j = 0; j < s->simplifications.size(); j++) {
-			delete s->simplifications[j];
+	// results of every query in the group, in candidate order
+	results.assign(numQueries, std::vector<Trajectory*>());
+	for (int c = 0; c < candidates.size(); c++) {
+		for (int i = firstResult[c]; i < numQueries; i++) {
+			results[i].push_back(candidates[c]);
 		}
-		delete queryTrajectory->simplifications[i];
 	}
-	delete queryTrajectory;
+}
 
-	return;
+// Solves all queries of a group and writes their results.
+// Before solving, also obtains the query trajectory (loaded from disk when it is
+// not present in the dataset) with its simplifications.
+inline void solveQueryGroup(AlgoData *a, QueryGroup &group, AlgorithmObjects *algo) {
+	bool cached;
+	bool prefetched;
+	Trajectory *queryTrajectory = acquireQueryTrajectory(a, group, algo, cached, prefetched);
 
-}
+	std::vector<std::vector<Trajectory*>> results;
+	solveGroupOn(a, group, algo, queryTrajectory, results);
+
+#if WRITE_OUTPUT_TO_QUERY 
+	if (group.queries[0]->knn > 0) {
+		a->resultWriter.writeKnn(algo->results, group.queries[0]->queryNumber, algo->nearest);
+	}
+	for (int i = 0; i < results.size(); i++) {
+		a->resultWriter.writeRange(algo->results, group.queries[i]->queryNumber, results[i]);
+	}
+#endif
 
-// Mutex guarding access to the queryset from the worker threads
-std::mutex queryMtx;
-// Number of queries allocated to a worker as one 'job'
-int querySteps = 20;
-
-// Returns a query index for a worker to solve, locking the query set
-int getConcurrentQuery(AlgoData *a) {
-	queryMtx.lock();
-	if (a->startedSolving > a->queries->size()) {
-		queryMtx.unlock();
-		return -1;
-	}
-	int returnQuery = a->startedSolving;
-	a->startedSolving += querySteps;
-	queryMtx.unlock();
-	if (returnQuery % 100 == 0) {
-		std::cout << " --- Solving: " << returnQuery << "\n";
-	}
-	return returnQuery;
+	releaseQueryTrajectory(a, group, algo, queryTrajectory, cached, prefetched);
 }
 
-// Function executed by the worker threads, obtains a query index
-// solves a fixed number of queries from that index, then
-// tries to obtain a new index. When no queries are left, it exits
-// and merges its statistics with the complete statistics.
-void worker(AlgoData *a, AlgorithmObjects *algo) {
-	int current = getConcurrentQuery(a);
-	std::vector<Query> &queries = *a->queries;
-	while (current != -1) {
-		int limit = querySteps;
-		if (current + querySteps > queries.size()) {
-			limit = queries.size() - current;
-		}
-		for (int step = 0; step < limit; step++) {
-			Query &c = queries[current + step];
-			solveQuery(a, c, algo);
-		}
-		current = getConcurrentQuery(a);
+// Function executed by the worker threads, gets query groups from the scheduler
+// until no groups are left, then helps other workers with their groups until all
+// are done. Records how long it was busy solving or helping.
+inline void worker(AlgoData *a, AlgorithmObjects *algo, int workerIndex) {
+	QueryScheduler::WorkerStats &stats = a->scheduler.stats[workerIndex];
+	int current;
+	algo->results = a->resultWriter.acquire();
+	while (a->scheduler.next(workerIndex, current)) {
+		auto started = std::chrono::steady_clock::now();
+		solveQueryGroup(a, a->queryGroups[current], algo);
+		stats.busySec += std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+		stats.solved++;
 	}
+	a->scheduler.finished();
+	while (a->scheduler.help(workerIndex, algo)) {}
+	a->resultWriter.submit(algo->results);
+	delete algo->results;
+	a->filteredBoundingBox += algo->filteredBoundingBox;
+	a->filteredSamples += algo->filteredSamples;
+	a->filteredVertices += algo->filteredVertices;
+	stats.prefetchWaitSec = algo->prefetchWaitSec;
 	delete algo;
 }
 
 
-void printMS(std::string msg, long ms) {
+inline void printMS(std::string msg, long ms) {
 	double timeSec = ms / 1000.0;
 	std::cout << msg << ": " << timeSec << " sec \n";
 }
 
-void print(std::string msg, double value) {
+inline void print(std::string msg, double value) {
 	std::cout << msg << ": " << value << "\n";
 }
 
 
-// Datastructure containing worker threads
-std::vector<std::thread*> threads;
+inline void printFilterStats(AlgoData *a) {
+#if USE_VERTEX_INDEX
+	VertexIndex *index = a->vertexIndex;
+	if (index != nullptr) {
+		std::cout << "Vertex index: " << index->cols << "x" << index->rows << " cells, level " << index->level
+			<< ", " << (index->bytes() + a->numWorkers * index->fieldBytes()) / (1024 * 1024) << " MB\n";
+	}
+	else {
+		std::cout << "Vertex index: not built, no range queries or it does not fit in " << vertexIndexBudgetMB << " MB\n";
+	}
+#endif
+	std::cout << "Filtered by bounding box: " << a->filteredBoundingBox << ", by sampled vertices: " << a->filteredSamples
+		<< ", by vertex index: " << a->filteredVertices << "\n";
+}
+
 
 // Spins up all worker threads, waits for them to complete,
 // then prints statistics.
-void solveQueries(AlgoData *a) {
+inline void solveQueries(AlgoData *a) {
+	planQueries(a);
+	// most expensive groups first, see QueryScheduler
+	std::vector<double> costs;
+	for (QueryGroup &g : a->queryGroups) {
+		g.estimatedCost = estimateGroupCost(a, g, a->fio);
+		costs.push_back(g.estimatedCost);
+	}
+	a->scheduler.init(a->numWorkers, costs);
+
+	// query trajectories that have to be loaded from disk are prefetched in the planned order
+	std::vector<QueryGroup*> loads;
+	for (int g : a->scheduler.plannedOrder()) {
+		if (a->datasetIndex.count(a->queryGroups[g].queryTrajectoryFilename) == 0) {
+			loads.push_back(&a->queryGroups[g]);
+		}
+	}
+	if (a->prefetchDepth > 0 && !loads.empty()) {
+		a->prefetcher = new QueryPrefetcher();
+		a->prefetcher->start(a, loads, a->prefetchDepth);
+	}
+	a->resultWriter.start(a->resultFile, a->perQueryResults);
+
+	auto started = std::chrono::steady_clock::now();
+	std::vector<std::thread*> threads;
+	for (int i = 0; i < a->numWorkers; i++) {
+		AlgorithmObjects *algo = new AlgorithmObjects();
+		algo->fio.sharePackedDataset(a->fio);
+		// cached query trajectories live in per-worker arenas owned by AlgoData
+		algo->arena = new Arena();
+		a->arenas.push_back(algo->arena);
+		std::thread *t = new std::thread(worker, a, algo, i);
+		threads.push_back(t);
+	}
+	for (int i = 0; i < a->numWorkers; i++) {
+		(*threads[i]).join();
+		delete threads[i];
+	}
+	double wallSec = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+
+	// load balance, idle is the time a worker was not solving while others still were
+	for (int i = 0; i < a->numWorkers; i++) {
+		QueryScheduler::WorkerStats &stats = a->scheduler.stats[i];
+		stats.idleSec = wallSec - stats.busySec;
+		std::cout << "Worker " << i << ": busy " << stats.busySec << " sec, idle " << stats.idleSec
+			<< " sec, groups " << stats.solved << " (stolen " << stats.stolen << "), helped " << stats.helped << " chunks"
+			<< ", waited " << stats.prefetchWaitSec << " sec for prefetch\n";
+	}
+	if (a->prefetcher != nullptr) {
+		a->prefetcher->finish();
+		std::cout << "Prefetch: depth " << a->prefetchDepth << ", " << a->prefetcher->prefetched << " query trajectories prefetched, "
+			<< a->prefetcher->loadedByWorkers << " loaded by workers\n";
+		delete a->prefetcher;
+		a->prefetcher = nullptr;
+	}
+	a->resultWriter.finish();
+	if (a->perQueryResults) {
+		std::cout << "Results: " << a->resultWriter.filesWritten << " files, " << a->resultWriter.bytesWritten << " bytes\n";
+	}
+	else {
+		std::cout << "Results: " << a->resultWriter.bytesWritten << " bytes written to " << a->resultFile << "\n";
+	}
+	printFilterStats(a);
+}
+
+// Number of dataset trajectories a join worker takes at once
+const int joinSteps = 16;
+
+// Join worker: takes rows i of the pair space from joinNext, and decides all pairs (i, j) with j > i
+// whose endpoints are within the join delta, with the pruning stages of the range queries.
+inline void joinWorker(AlgoData *a, AlgorithmObjects *algo) {
+	std::vector<Trajectory*> &trajectories = *a->trajectories;
+	Query joinQuery;
+	joinQuery.queryDelta = a->joinDelta;
+	joinQuery.queryNumber = -1;
+	QueryGroup group;
+	group.queries.push_back(&joinQuery);
+	std::vector<Trajectory*> &candidates = algo->candidates;
+	std::vector<int> firstResult;
+	int first;
+	algo->results = a->resultWriter.acquire();
+	while ((first = a->joinNext.fetch_add(joinSteps)) < trajectories.size()) {
+		int last = std::min((int)trajectories.size(), first + joinSteps);
+		for (int i = first; i < last; i++) {
+			Trajectory *t = trajectories[i];
+			if (t == nullptr) continue;
+			// every unordered pair once
+			candidates.clear();
+			collectDiHashPoints(a, joinQuery, *t, [&](Trajectory *c) -> void {
+				if (c->uniqueIDInDataset > t->uniqueIDInDataset) {
+					candidates.push_back(c);
+				}
+			});
+			pruneWithVertexIndex(a, algo, *t, a->joinDelta, candidates);
+			firstResult.resize(candidates.size());
+			for (int c = 0; c < candidates.size(); c += intraQueryChunkSize) {
+				int count = std::min((int)candidates.size() - c, intraQueryChunkSize);
+				decideCandidatesForGroup(group, algo, *t, &candidates[c], count, &firstResult[c]);
+			}
+			for (int c = 0; c < candidates.size(); c++) {
+				if (firstResult[c] == 0) {
+					a->resultWriter.append(algo->results, t->name + " " + candidates[c]->name + "\n");
+					algo->joinPairs++;
+				}
+			}
+		}
+	}
+	a->resultWriter.submit(algo->results);
+	delete algo->results;
+}
+
+// Similarity join of the dataset with itself: writes every unordered pair of dataset trajectories
+// within frechet distance joinDelta to joinOutputFile, one "name name" line per pair.
+inline void solveJoin(AlgoData *a) {
+	// pairs are streamed to the output file while joining
+	a->resultWriter.start(a->joinOutputFile, false);
+	std::vector<AlgorithmObjects*> workers;
+	std::vector<std::thread*> threads;
 	for (int i = 0; i < a->numWorkers; i++) {
-		std::thread *t = new std::thread(worker, a, new AlgorithmObjects());
+		AlgorithmObjects *algo = new AlgorithmObjects();
+		workers.push_back(algo);
+		std::thread *t = new std::thread(joinWorker, a, algo);
 		threads.push_back(t);
 	}
 	for (int i = 0; i < a->numWorkers; i++) {
 		(*threads[i]).join();
 		delete threads[i];
 	}
+	a->resultWriter.finish();
+
+	long pairs = 0;
+	for (AlgorithmObjects *algo : workers) {
+		pairs += algo->joinPairs;
+		a->filteredBoundingBox += algo->filteredBoundingBox;
+		a->filteredSamples += algo->filteredSamples;
+		a->filteredVertices += algo->filteredVertices;
+		delete algo;
+	}
+	std::cout << "Join pairs: " << pairs << "\n";
+	printFilterStats(a);
 }
 
-void cleanup(AlgoData *a) {
-	//TODO: improve code by moving deallocations here
-	//TODO: not strictly necessary because program exits
+// Frees the preprocessed dataset: trajectories, indices, arenas and the packed dataset they were
+// loaded from. The dataset and query file contents (names, queries, bounding box) belong to whoever
+// filled them in.
+inline void cleanup(AlgoData *a) {
+	if (a->trajectories != nullptr) {
+		for (Trajectory *t : *a->trajectories) {
+			if (t != nullptr) {
+				deleteQueryTrajectory(t);
+			}
+		}
+		delete a->trajectories;
+		a->trajectories = nullptr;
+	}
+	for (Trajectory *t : a->queryCache) {
+		if (t != nullptr) {
+			deleteQueryTrajectory(t);
+		}
+	}
+	a->queryCache.clear();
+	delete a->diHash;
+	delete a->endpointIndex;
+	delete a->vertexIndex;
+	a->diHash = nullptr;
+	a->endpointIndex = nullptr;
+	a->vertexIndex = nullptr;
+	for (Arena *arena : a->arenas) {
+		delete arena;
+	}
+	a->arenas.clear();
+	delete a->snapshot;
+	a->snapshot = nullptr;
+	a->fio.closePackedDataset();
 }
 
 // Entrypoint for the algorithm
-void runAlgorithm(AlgoData *a) {
+inline void runAlgorithm(AlgoData *a) {
 	long timeMS = std::chrono::system_clock::now().time_since_epoch() /
 		std::chrono::milliseconds(1);
 	std::cout << " - Preprocess\n";
@@ -219,7 +537,12 @@ void runAlgorithm(AlgoData *a) {
 	long ptimeMS = std::chrono::system_clock::now().time_since_epoch() /
 		std::chrono::milliseconds(1);
 	std::cout << " - Solve\n";
-	solveQueries(a);
+	if (a->joinDelta > 0) {
+		solveJoin(a);
+	}
+	else {
+		solveQueries(a);
+	}
 	std::cout << " - Cleanup\n";
 	cleanup(a);
 	long total = std::chrono::system_clock::now().time_since_epoch() /
@@ -0,0 +1,112 @@
+// Bump allocator and array views used to store trajectory data contiguously,
+// instead of in separately heap allocated vectors per trajectory.
+#pragma once
+
+#include <vector>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+
+// Hands out memory from large blocks. Memory is only given back all at once,
+// by reset() or when the arena is destroyed. Not thread-safe, every thread
+// allocates from its own arena.
+class Arena {
+	std::vector<char*> blocks;
+	size_t blockSize;
+	char *current = nullptr;
+	size_t left = 0;
+
+	// number of bytes handed out, for statistics
+	size_t used = 0;
+
+public:
+	Arena(size_t iBlockSize = 1024 * 1024) {
+		blockSize = iBlockSize;
+	}
+
+	~Arena() {
+		for (char *b : blocks) {
+			free(b);
+		}
+	}
+
+	Arena(const Arena&) = delete;
+	Arena& operator=(const Arena&) = delete;
+
+	template<typename T>
+	T* allocate(size_t n) {
+		size_t bytes = n * sizeof(T);
+		// keep everything aligned to 16 bytes
+		bytes = (bytes + 15) & ~(size_t)15;
+		if (bytes > left) {
+			size_t size = bytes > blockSize ? bytes : blockSize;
+			current = (char*)malloc(size);
+			blocks.push_back(current);
+			left = size;
+		}
+		T *result = (T*)current;
+		current += bytes;
+		left -= bytes;
+		used += bytes;
+		return result;
+	}
+
+	// Frees everything except the first block, which is reused
+	void reset() {
+		for (int i = 1; i < blocks.size(); i++) {
+			free(blocks[i]);
+		}
+		if (blocks.size() > 1) {
+			blocks.resize(1);
+		}
+		current = blocks.empty() ? nullptr : blocks[0];
+		left = blocks.empty() ? 0 : blockSize;
+		used = 0;
+	}
+
+	size_t bytesUsed() {
+		return used;
+	}
+};
+
+// Fixed size view on an array of T owned by an Arena
+template<typename T>
+class ArenaArray {
+	T *items = nullptr;
+	int length = 0;
+
+public:
+	inline T& operator[](int i) { return items[i]; }
+	inline const T& operator[](int i) const { return items[i]; }
+	inline int size() const { return length; }
+	inline bool empty() const { return length == 0; }
+	inline T* data() { return items; }
+	inline T* begin() { return items; }
+	inline T* end() { return items + length; }
+
+	// points the view at n new, uninitialized items of the arena
+	void allocate(Arena &arena, int n) {
+		items = n > 0 ? arena.allocate<T>(n) : nullptr;
+		length = n;
+	}
+
+	void assign(Arena &arena, const T *source, int n) {
+		allocate(arena, n);
+		if (n > 0) memcpy(items, source, n * sizeof(T));
+	}
+
+	void assign(Arena &arena, const std::vector<T> &source) {
+		assign(arena, source.data(), source.size());
+	}
+
+	// points the view at memory owned by someone else
+	void view(T *source, int n) {
+		items = source;
+		length = n;
+	}
+
+	// drops the last items of the view, the arena memory is not reclaimed
+	void shrink(int n) {
+		if (n < length) length = n;
+	}
+};
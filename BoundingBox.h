@@ -22,6 +22,13 @@ public:
 		if (y > maxy) maxy = y;
 	}
 
+	// squared distance from a point to the box, 0 inside it
+	double distanceSQ(double x, double y) {
+		double dx = std::max(0.0, std::max(minx - x, x - maxx));
+		double dy = std::max(0.0, std::max(miny - y, y - maxy));
+		return dx*dx + dy*dy;
+	}
+
 	double getDiagonal() {
 		double width = maxx - minx;
 		double height = maxy - miny;
@@ -0,0 +1,194 @@
+#pragma once
+
+
+#include "Vertex.h"
+#include "FrechetUtil.h"
+#include "settings.h"
+
+#include <algorithm>
+#include <vector>
+#include <stdio.h>
+
+
+
+// Decides frechet distance <= epsLow and <= epsHigh (epsLow < epsHigh) in one sweep of the freespace diagram.
+// Only cells reachable for epsHigh are visited, reachability for epsLow is tracked inside
+// that region, since everything reachable for epsLow is also reachable for epsHigh.
+// Same propagation as CDFQueued, without jumps.
+// Optionally the sweep is restricted to a corridor of rows per column, cells outside it are
+// treated as blocked. It can also report the rows of the cells it visited, per column.
+class CDFQDual {
+
+private:
+	// reachable left edge of a cell in the current column, lowest reachable point per epsilon, > 1 means unreachable
+	struct QEntry {
+		int row_index;
+		double lowest_high;
+		double lowest_low;
+	};
+
+	std::vector<QEntry> queue[2];
+	int queueSize[2];
+
+	double dist(Vertex p, Vertex q) {
+		double dx = p.x - q.x;
+		double dy = p.y - q.y;
+		return sqrt(dx*dx + dy*dy);
+	}
+
+	// lowest reachable point on the far edge of a cell, from the lowest reachable point on the
+	// opposite edge (near) and on the adjacent edge (side), given the free interval of the far edge
+	inline double propagate(bool isFree, Range &far, double near, double side) {
+		if (!isFree) return 2;
+		if (side <= 1) return far.start;
+		if (near <= far.end) return std::max(near, far.start);
+		return 2;
+	}
+
+public:
+
+	struct Result {
+		bool low;// frechet distance <= epsLow
+		bool high;// frechet distance <= epsHigh
+	};
+
+	int numRows = 0;
+
+	// epsLow <= 0 is never reachable.
+	// rowLow/rowHigh: optional corridor, only rows rowLow[column] to rowHigh[column] are explored.
+	// visitedLow/visitedHigh: optional, set to the lowest/highest row visited in each column (reachable
+	// for epsHigh), or -1/-2 for a column without visited cells.
+	Result calculate(
+		Vertex *P, Vertex *Q,
+		Segment *Psegs, Segment *Qsegs,
+		int size_p, int size_q,
+		double epsLow, double epsHigh,
+		const int *rowLow = nullptr, const int *rowHigh = nullptr,
+		int *visitedLow = nullptr, int *visitedHigh = nullptr
+	) {
+		Result result = { false, false };
+		double startDist = dist(P[0], Q[0]);
+		double endDist = dist(P[size_p - 1], Q[size_q - 1]);
+		if (startDist > epsHigh || endDist > epsHigh) return result;
+		if (size_p <= 1 || size_q <= 1) return result;
+		bool lowPossible = epsLow > 0 && startDist <= epsLow && endDist <= epsLow;
+
+		int first = 0;
+		int second = 1;
+
+		Range rightLow, rightHigh, topLow, topHigh;
+
+		// ensure queue capacity
+		int max = std::max(size_p, size_q);
+		if (queue[0].size() < max) {
+			queue[0].resize(max);
+			queue[1].resize(max);
+		}
+
+		// the bottom left corner is free, checked by startDist
+		queue[first][0].row_index = 0;
+		queue[first][0].lowest_high = 0;
+		queue[first][0].lowest_low = lowPossible ? 0 : 2;
+		queueSize[first] = 1;
+
+		if (visitedLow != nullptr) {
+			for (int column = 0; column < size_q - 1; column++) {
+				visitedLow[column] = -1;
+				visitedHigh[column] = -2;
+			}
+		}
+
+		// For each column
+		for (int column = 0; column < size_q - 1; column++) {
+			if (queueSize[first] == 0) {
+				// nothing reachable anymore
+				return result;
+			}
+			queueSize[second] = 0;
+			int qIndex = 0;
+			int row = 0;
+			int lastRow = size_p - 2;
+			if (rowLow != nullptr) {
+				row = rowLow[column];
+				lastRow = std::min(lastRow, rowHigh[column]);
+			}
+			int firstVisited = -1;
+			// while there's reachable cells left in the queue
+			while (qIndex < queueSize[first]) {
+				if (queue[first][qIndex].row_index < row) {
+					// below the corridor
+					qIndex++;
+					continue;
+				}
+				if (queue[first][qIndex].row_index > lastRow) {
+					// above the corridor
+					break;
+				}
+				row = queue[first][qIndex].row_index;
+				if (firstVisited == -1) firstVisited = row;
+				// lowest reachable point on the bottom edge of the cell
+				double bottomHigh = 2;
+				double bottomLow = 2;
+				// continue until reachability cannot propagate upwards, consuming the queue as we progress
+				do {
+					double leftHigh = 2;
+					double leftLow = 2;
+					if (qIndex < queueSize[first] && queue[first][qIndex].row_index == row) {
+						leftHigh = queue[first][qIndex].lowest_high;
+						leftLow = queue[first][qIndex].lowest_low;
+						qIndex++;
+					}
+
+					// intervals for epsLow are only needed when the cell is reachable for epsLow
+					bool lowReachable = leftLow <= 1 || bottomLow <= 1;
+					bool freeLow = false;
+					bool freeHigh = lowReachable
+						? computeIntervalPair(Q[column + 1], P[row], Psegs[row], epsLow, epsHigh, rightLow, rightHigh, freeLow)
+						: computeInterval(Q[column + 1], P[row], Psegs[row], epsHigh, rightHigh);
+					double lowestHigh = propagate(freeHigh, rightHigh, leftHigh, bottomHigh);
+					if (lowestHigh <= 1) {
+						queue[second][queueSize[second]].row_index = row;
+						queue[second][queueSize[second]].lowest_high = lowestHigh;
+						queue[second][queueSize[second]].lowest_low = propagate(freeLow, rightLow, leftLow, bottomLow);
+						queueSize[second]++;
+					}
+
+					freeHigh = lowReachable
+						? computeIntervalPair(P[row + 1], Q[column], Qsegs[column], epsLow, epsHigh, topLow, topHigh, freeLow)
+						: computeInterval(P[row + 1], Q[column], Qsegs[column], epsHigh, topHigh);
+					double nextHigh = propagate(freeHigh, topHigh, bottomHigh, leftHigh);
+					bottomLow = nextHigh <= 1 ? propagate(freeLow, topLow, bottomLow, leftLow) : 2;
+					bottomHigh = nextHigh;
+
+					// propagated reachability by one cell, so look at next row
+					row++;
+					numRows++;
+				} while (bottomHigh <= 1 && row <= lastRow);
+			}
+			if (visitedLow != nullptr && firstVisited != -1) {
+				visitedLow[column] = firstVisited;
+				visitedHigh[column] = row - 1;
+			}
+
+			// swap first and second column
+			int temp = first;
+			first = second;
+			second = temp;
+		}
+
+		// the top right corner is free, checked by endDist, so reaching the last cell is enough
+		int endIndex = queueSize[first] - 1;
+		if (endIndex < 0) return result;
+		QEntry &last = queue[first][endIndex];
+		if (last.row_index != size_p - 2) return result;
+		result.high = last.lowest_high <= 1;
+		result.low = lowPossible && last.lowest_low <= 1;
+		return result;
+	}
+
+	Result calculate(Trajectory &P, Trajectory &Q, double epsLow, double epsHigh,
+		const int *rowLow = nullptr, const int *rowHigh = nullptr, int *visitedLow = nullptr, int *visitedHigh = nullptr) {
+		return calculate(P.vertices.data(), Q.vertices.data(), P.segments.data(), Q.segments.data(), P.size, Q.size, epsLow, epsHigh,
+			rowLow, rowHigh, visitedLow, visitedHigh);
+	}
+};
@@ -3,6 +3,8 @@
 
 #include "Vertex.h"
 #include "FrechetUtil.h"
+#include "FrechetSIMD.h"
+#include "settings.h"
 
 #include <algorithm>
 #include <vector>
@@ -25,6 +27,9 @@ private:
 	std::vector<QEntry> queue[2];
 	int queueSize[2];
 
+	// batched interval computation for the column being swept
+	ColumnIntervals intervals;
+
 	// wrapper distance function
 	double dist(Vertex p, Vertex q) {
 		double dx = p.x - q.x;
@@ -34,9 +39,9 @@ private:
 
 	// compute frechet distance of point vs line
 	inline double computeSegmentFrechet(
-		Portal &p,
+		const Portal &p,
 		int q,
-		std::vector<Vertex> &p_array, std::vector<Vertex> &q_array
+		Vertex *p_array, Vertex *q_array
 	) {
 		Vertex &pstart = p_array[p.source];
 		Vertex &pend = p_array[p.destination];
@@ -68,12 +73,13 @@ public:
 
 	// calculate frechet decision between P, and Q given queryDelta
 	bool calculate(
-		std::vector<Vertex> &P, std::vector<Vertex> &Q,
+		Vertex *P, Vertex *Q,
+		Segment *Psegs, Segment *Qsegs,
 		int offset_p, int offset_q,
 		int size_p, int size_q,
 		double queryDelta,
 		double baseQueryDelta,
-		std::map<int, std::vector<Portal>> &portals
+		const PortalTable &portals
 	) {
 		double startDist = dist(P[offset_p], Q[offset_q]);
 		double endDist = dist(P[size_p - 1], Q[size_q - 1]);
@@ -117,6 +123,9 @@ public:
 				return false;
 			}
 			queueSize[second] = 0;
+#if USE_SIMD_INTERVALS
+			intervals.startColumn(P, Psegs, size_p, Q[column], Q[column + 1], Qsegs[column], queryDelta);
+#endif
 			int row = queue[first][0].start_row_index;
 			int qIndex = 0;
 			// while there's reachable cells left in the queue
@@ -128,7 +137,11 @@ public:
 					// tracks whether we overshoot the queue
 					bool outsideQueue = qIndex >= queueSize[first];
 					// Right edge stored in Rf, RFree = false means not free
-					bool RFree = computeInterval(Q[column + 1], P[row], P[row + 1], queryDelta, Rf);
+#if USE_SIMD_INTERVALS
+					bool RFree = intervals.right(row, Rf);
+#else
+					bool RFree = computeInterval(Q[column + 1], P[row], Psegs[row], queryDelta, Rf);
+#endif
 					if (RFree) {
 						if (left_most_top <= 1) {
 							double newLR = Rf.start;
@@ -166,7 +179,11 @@ public:
 						}
 					}
 					// Top edge stored in Tf, TFree = false means not free
-					bool TFree = computeInterval(P[row + 1], Q[column], Q[column + 1], queryDelta, Tf);
+#if USE_SIMD_INTERVALS
+					bool TFree = intervals.top(row, Tf);
+#else
+					bool TFree = computeInterval(P[row + 1], Q[column], Qsegs[column], queryDelta, Tf);
+#endif
 					if (!outsideQueue && row <= queue[first][qIndex].end_row_index && row >= queue[first][qIndex].start_row_index) {
 						if (row == queue[first][qIndex].end_row_index) {
 							// consume the first queue
@@ -191,9 +208,9 @@ public:
 						// check if minimum jump distance is big enough
 						int gapSize = queue[first][qIndex].end_row_index - queue[first][qIndex].start_row_index;
 						if (gapSize > 1) {
-							std::vector<Portal> &ports = portals[row];
 							choice.source = -1;
-							for (Portal &p : ports) {
+							for (const Portal *port = portals.begin(row); port != portals.end(row); port++) {
+								const Portal &p = *port;
 								int jumpSize = p.destination - p.source;
 								// check if jump within range
 								if (p.destination <= queue[first][qIndex].end_row_index) {
@@ -237,11 +254,11 @@ public:
 
 	// wrapper
 	bool calculate(Trajectory &P, Trajectory &Q, double queryDelta, double baseQueryDelta) {
-		return calculate(P.vertices, Q.vertices, 0, 0, P.size, Q.size, queryDelta, baseQueryDelta, P.simpPortals);
+		return calculate(P.vertices.data(), Q.vertices.data(), P.segments.data(), Q.segments.data(), 0, 0, P.size, Q.size, queryDelta, baseQueryDelta, P.simpPortals);
 	}
 
 	// wrapper
 	bool calculate(Trajectory &P, Trajectory &Q, double queryDelta) {
-		return calculate(P.vertices, Q.vertices, 0, 0, P.size, Q.size, queryDelta, queryDelta, P.simpPortals);
+		return calculate(P.vertices.data(), Q.vertices.data(), P.segments.data(), Q.segments.data(), 0, 0, P.size, Q.size, queryDelta, queryDelta, P.simpPortals);
 	}
 };
@@ -3,6 +3,8 @@
 
 #include "Vertex.h"
 #include "FrechetUtil.h"
+#include "FrechetSIMD.h"
+#include "settings.h"
 
 #include <algorithm>
 #include <vector>
@@ -24,6 +26,9 @@ private:
 	std::vector<QEntry> queue[2];
 	int queueSize[2];
 
+	// batched interval computation for the column being swept
+	ColumnIntervals intervals;
+
 	double dist(Vertex p, Vertex q) {
 		double dx = p.x - q.x;
 		double dy = p.y - q.y;
@@ -35,7 +40,8 @@ public:
 
 	int numRows = 0;
 	bool calculate(
-		std::vector<Vertex> &P, std::vector<Vertex> &Q,
+		Vertex *P, Vertex *Q,
+		Segment *Psegs, Segment *Qsegs,
 		int offset_p, int offset_q,
 		int size_p, int size_q,
 		double queryDelta
@@ -80,6 +86,9 @@ public:
 				return false;
 			}
 			queueSize[second] = 0;
+#if USE_SIMD_INTERVALS
+			intervals.startColumn(P, Psegs, size_p, Q[column], Q[column + 1], Qsegs[column], queryDelta);
+#endif
 			int row = queue[first][0].row_index;
 			int qIndex = 0;
 			// while there's reachable cells left in the queue
@@ -91,7 +100,11 @@ public:
 					// tracks whether we overshoot the queue
 					bool outsideQueue = qIndex >= queueSize[first];
 					// Right edge stored in Rf, RFree = false means not free
-					bool RFree = computeInterval(Q[column + 1], P[row], P[row + 1], queryDelta, Rf);
+#if USE_SIMD_INTERVALS
+					bool RFree = intervals.right(row, Rf);
+#else
+					bool RFree = computeInterval(Q[column + 1], P[row], Psegs[row], queryDelta, Rf);
+#endif
 					if (RFree) {
 						if (left_most_top <= 1) {
 							// push to queue
@@ -110,7 +123,11 @@ public:
 						}
 					}
 					// Top edge stored in Tf, TFree = false means not free
-					bool TFree = computeInterval(P[row + 1], Q[column], Q[column + 1], queryDelta, Tf);
+#if USE_SIMD_INTERVALS
+					bool TFree = intervals.top(row, Tf);
+#else
+					bool TFree = computeInterval(P[row + 1], Q[column], Qsegs[column], queryDelta, Tf);
+#endif
 					if (!outsideQueue && row == queue[first][qIndex].row_index) {
 						// consume the first queue
 						qIndex++;
@@ -145,6 +162,6 @@ public:
 	}
 
 	bool calculate(Trajectory &P, Trajectory &Q, double queryDelta) {
-		return calculate(P.vertices, Q.vertices, 0, 0, P.size, Q.size, queryDelta);
+		return calculate(P.vertices.data(), Q.vertices.data(), P.segments.data(), Q.segments.data(), 0, 0, P.size, Q.size, queryDelta);
 	}
 };
@@ -0,0 +1,47 @@
+// Candidate batches for the staged query pipeline in AlgoSteps.h
+#pragma once
+
+#include "Trajectory.h"
+#include "Query.h"
+
+#include <vector>
+
+// Outcome of a pruning stage for one candidate
+enum Decision { DECIDED_NO, DECIDED_YES, MAYBE };
+
+// One decision to make: is dataset trajectory t a result of query q.
+// candidate is the index of t in the candidate array of the caller.
+struct CandidateProbe {
+	Trajectory *t;
+	Query *q;
+	int candidate;
+};
+
+typedef std::vector<CandidateProbe> CandidateBatch;
+
+// Runs one pruning stage over a batch. Probes decided by the stage are moved to yes or no,
+// undecided (MAYBE) probes stay in batch, in their original order.
+// Stage is any callable mapping a CandidateProbe& to a Decision, so it can be inlined.
+template<typename Stage>
+inline void runStage(CandidateBatch &batch, CandidateBatch &yes, CandidateBatch &no, Stage stage) {
+	int kept = 0;
+	int n = batch.size();
+	for (int i = 0; i < n; i++) {
+#if defined(__GNUC__)
+		// the stage starts with loading the candidate object, fetch it a bit ahead
+		if (i + 2 < n) __builtin_prefetch(batch[i + 2].t);
+#endif
+		CandidateProbe &p = batch[i];
+		switch (stage(p)) {
+		case DECIDED_YES:
+			yes.push_back(p);
+			break;
+		case DECIDED_NO:
+			no.push_back(p);
+			break;
+		default:
+			batch[kept++] = p;
+		}
+	}
+	batch.resize(kept);
+}
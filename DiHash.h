@@ -4,10 +4,15 @@
 #include "BoundingBox.h"
 
 #include <stdio.h>
+#include <cmath>
 #include <vector>
-#include <unordered_set>
+#include <functional>
 
-// Adapted from implementation of Yago Diez, could be sped up but is not a bottleneck
+// Adapted from implementation of Yago Diez
+// Start points are collected with addPoint, then frozen into flat per-cell arrays by freeze(),
+// which also subdivides cells that are too dense into a finer second level grid.
+// The end point of every trajectory is stored next to its start point, so the end point
+// check of a start hit needs no access to the trajectory.
 class DiHash
 {
 public:
@@ -17,7 +22,47 @@ public:
 
 	double tol; // tolerance to prevent numerical representation errors
 
-	std::vector<Vertex>** elements;
+	// Frozen grid in compressed sparse row form. Cell (x,y) has index x * slotsPerDimension + y,
+	// and its points are at [offsets[cell], offsets[cell + 1]) in the xs/ys/exs/eys/ids columns.
+	// Cells with equal x and consecutive y are consecutive in memory.
+	// Cells holding more than maxCellPoints points are subdivided into a finer grid of
+	// at most maxSubSlots slots per dimension. The points of such a cell stay in the
+	// cell's run, ordered by sub cell, and the sub grid holds offsets into that run.
+	struct SubGrid {
+		int slots;
+		double minx;
+		double miny;
+		double pasx;
+		double pasy;
+		std::vector<int> offsets;
+	};
+
+	struct Grid {
+		std::vector<int> offsets;
+		std::vector<double> xs;
+		std::vector<double> ys;
+		std::vector<double> exs; // end point of the trajectory starting at xs/ys
+		std::vector<double> eys;
+		std::vector<int> ids;
+		std::vector<int> subGridOf; // index into subGrids, -1 if the cell is not subdivided
+		std::vector<SubGrid> subGrids;
+	};
+
+	int maxCellPoints = 32;
+	int maxSubSlots = 16;
+
+	// grid of the start points
+	Grid grid;
+
+	// points added before freeze() is called
+	struct PendingPoint {
+		double x;
+		double y;
+		double ex;
+		double ey;
+		int trajectoryNumber;
+	};
+	std::vector<PendingPoint> pending;
 
 	DiHash(BoundingBox &boundingBox, int numC, double iTol) {
 
@@ -33,24 +78,144 @@ public:
 		limits[0][1] = boundingBox.maxx; //max in X
 		limits[1][0] = boundingBox.miny; //min in Y
 		limits[1][1] = boundingBox.maxy; //max in Y
+	}
 
-		// Now that we have extreme dimensions, set points in its corresponding part of the grid
 
-		elements = new std::vector<Vertex>*[slotsPerDimension];
-		for (int i = 0; i < slotsPerDimension; i++) {
-			elements[i] = new std::vector<Vertex>[slotsPerDimension];
-		}
+	void addPoint(Vertex start, Vertex end, int trajectoryNumber) {
+		pending.push_back({ start.x, start.y, end.x, end.y, trajectoryNumber });
 	}
 
+	// Builds the CSR grid from all added points, must be called before querying
+	void freeze() {
+		int numCells = slotsPerDimension * slotsPerDimension;
+		std::vector<PendingPoint> &points = pending;
+		std::vector<int> cellOf(points.size());
+		grid.offsets.assign(numCells + 1, 0);
+		// count points per cell
+		for (int i = 0; i < points.size(); i++) {
+			int x = findSlot(points[i].x, 'x', false);
+			int y = findSlot(points[i].y, 'y', false);
+			cellOf[i] = x * slotsPerDimension + y;
+			grid.offsets[cellOf[i] + 1]++;
+		}
+		for (int c = 0; c < numCells; c++) {
+			grid.offsets[c + 1] += grid.offsets[c];
+		}
+		// scatter into the columns
+		grid.xs.resize(points.size());
+		grid.ys.resize(points.size());
+		grid.exs.resize(points.size());
+		grid.eys.resize(points.size());
+		grid.ids.resize(points.size());
+		std::vector<int> fill(grid.offsets.begin(), grid.offsets.end() - 1);
+		for (int i = 0; i < points.size(); i++) {
+			int pos = fill[cellOf[i]]++;
+			grid.xs[pos] = points[i].x;
+			grid.ys[pos] = points[i].y;
+			grid.exs[pos] = points[i].ex;
+			grid.eys[pos] = points[i].ey;
+			grid.ids[pos] = points[i].trajectoryNumber;
+		}
+		std::vector<PendingPoint>().swap(points);
+		subdivideDenseCells(grid);
+	}
 
-	void addPoint(Vertex pActual) {
-		int x, y;
+	// Builds a sub grid for every cell that holds too many points, sized to the number of points in it
+	void subdivideDenseCells(Grid &grid) {
+		int numCells = slotsPerDimension * slotsPerDimension;
+		double pasx = fabs(limits[0][1] - limits[0][0]) / slotsPerDimension;
+		double pasy = fabs(limits[1][1] - limits[1][0]) / slotsPerDimension;
+		grid.subGridOf.assign(numCells, -1);
+		grid.subGrids.clear();
+		std::vector<int> subCellOf;
+		std::vector<double> xs, ys, exs, eys;
+		std::vector<int> ids;
+		for (int c = 0; c < numCells; c++) {
+			int first = grid.offsets[c];
+			int count = grid.offsets[c + 1] - first;
+			if (count <= maxCellPoints || pasx <= 0 || pasy <= 0) continue;
+
+			SubGrid sub;
+			sub.slots = std::min(maxSubSlots, std::max(2, (int)ceil(sqrt(count / (double)maxCellPoints))));
+			sub.minx = limits[0][0] + pasx * (c / slotsPerDimension);
+			sub.miny = limits[1][0] + pasy * (c % slotsPerDimension);
+			sub.pasx = pasx / sub.slots;
+			sub.pasy = pasy / sub.slots;
+			sub.offsets.assign(sub.slots * sub.slots + 1, 0);
+
+			// counting sort of the cell's run by sub cell
+			subCellOf.resize(count);
+			for (int k = 0; k < count; k++) {
+				int sc = subSlot(sub, grid.xs[first + k], 'x') * sub.slots + subSlot(sub, grid.ys[first + k], 'y');
+				subCellOf[k] = sc;
+				sub.offsets[sc + 1]++;
+			}
+			sub.offsets[0] = first;
+			for (int sc = 0; sc < sub.slots * sub.slots; sc++) {
+				sub.offsets[sc + 1] += sub.offsets[sc];
+			}
+			xs.assign(grid.xs.begin() + first, grid.xs.begin() + first + count);
+			ys.assign(grid.ys.begin() + first, grid.ys.begin() + first + count);
+			exs.assign(grid.exs.begin() + first, grid.exs.begin() + first + count);
+			eys.assign(grid.eys.begin() + first, grid.eys.begin() + first + count);
+			ids.assign(grid.ids.begin() + first, grid.ids.begin() + first + count);
+			std::vector<int> fill(sub.offsets.begin(), sub.offsets.end() - 1);
+			for (int k = 0; k < count; k++) {
+				int pos = fill[subCellOf[k]]++;
+				grid.xs[pos] = xs[k];
+				grid.ys[pos] = ys[k];
+				grid.exs[pos] = exs[k];
+				grid.eys[pos] = eys[k];
+				grid.ids[pos] = ids[k];
+			}
 
-		x = findSlot(pActual.x, 'x', false);
-		y = findSlot(pActual.y, 'y', false);
+			grid.subGridOf[c] = grid.subGrids.size();
+			grid.subGrids.push_back(sub);
+		}
+	}
 
-		elements[x][y].push_back(pActual);
+	// slot of val in a sub grid, values outside the sub grid are clamped to its border slots
+	inline int subSlot(SubGrid &sub, double val, char type) {
+		int retorn = type == 'x' ? (int)floor((val - sub.minx) / sub.pasx) : (int)floor((val - sub.miny) / sub.pasy);
+		if (retorn < 0) return 0;
+		if (retorn >= sub.slots) return sub.slots - 1;
+		return retorn;
+	}
 
+	// Calls visit(first, last) for every contiguous run of points in the cells touched
+	// by the square [p.x - eps, p.x + eps] x [p.y - eps, p.y + eps]
+	template<typename F>
+	inline void forEachRun(Grid &grid, Vertex &p, double eps, F visit) {
+		int minX, maxX, minY, maxY;
+		slotsTouched(p.x - eps, p.x + eps, 'x', minX, maxX);
+		slotsTouched(p.y - eps, p.y + eps, 'y', minY, maxY);
+		bool subdivided = !grid.subGrids.empty();
+
+		for (int i = minX; i <= maxX; i++) {
+			int rowCell = i * slotsPerDimension;
+			if (!subdivided) {
+				// the touched cells of one x slot form one contiguous run
+				visit(grid.offsets[rowCell + minY], grid.offsets[rowCell + maxY + 1]);
+				continue;
+			}
+			int runStart = grid.offsets[rowCell + minY];
+			for (int j = minY; j <= maxY; j++) {
+				int s = grid.subGridOf[rowCell + j];
+				if (s == -1) continue;
+				// flush the plain cells before this one, then visit the touched sub cells
+				visit(runStart, grid.offsets[rowCell + j]);
+				runStart = grid.offsets[rowCell + j + 1];
+				SubGrid &sub = grid.subGrids[s];
+				int sMinX = subSlot(sub, p.x - eps, 'x');
+				int sMaxX = subSlot(sub, p.x + eps, 'x');
+				int sMinY = subSlot(sub, p.y - eps, 'y');
+				int sMaxY = subSlot(sub, p.y + eps, 'y');
+				for (int si = sMinX; si <= sMaxX; si++) {
+					visit(sub.offsets[si * sub.slots + sMinY], sub.offsets[si * sub.slots + sMaxY + 1]);
+				}
+			}
+			visit(runStart, grid.offsets[rowCell + maxY + 1]);
+		}
 	}
 
 	int findSlot(double val, char type, bool allowOverflow) {
@@ -125,75 +290,32 @@ public:
 		return (min + pas * c);
 	}
 
-	// Given a type of search (x or y) and a search range (min, max(, return the two indexes of the first and last slots affected by the search
-	int* slotsTouched(double min, double max, char type) {
-		// first position of the following vector is for the minimum slot affected and second for the maximum
-		int* retorn = new int[2];
-
-		retorn[0] = findSlot(min, type, true);
-		retorn[1] = findSlot(max, type, true);
-
-		return retorn;
-	}
-
-	// Return neighbors at range strictly less than distance for a given point, does not return the query point if present
-	void neighbors(Vertex &p, double eps, std::unordered_set<int> &retorn) {
-		int* limitsX = slotsTouched(p.x - eps, p.x + eps, 'x');
-		int* limitsY = slotsTouched(p.y - eps, p.y + eps, 'y');
-
-		for (int i = limitsX[0]; i <= limitsX[1]; i++) {
-			for (int j = limitsY[0]; j <= limitsY[1]; j++) {
-				for (Vertex &pActual : elements[i][j]) {
-					if (pActual.isStart == p.isStart) {
-						double dx = p.x - pActual.x;
-						double dy = p.y - pActual.y;
-						double distSQ = dx * dx + dy * dy;
-						if (distSQ < eps * eps) {
-							retorn.insert(pActual.trajectoryNumber);
-						}
-					}
-				}
-
-			}
-		}
-		delete[] limitsX;
-		delete[] limitsY;
+	// Given a type of search (x or y) and a search range (min, max), sets the indexes of the first and last slots affected by the search
+	void slotsTouched(double min, double max, char type, int &first, int &last) {
+		first = findSlot(min, type, true);
+		last = findSlot(max, type, true);
 	}
 
-	// Emits neighbors at range strictly less than distance for a given point, does not return the query point if present
-	// also checks endpoints directly
+	// Emits trajectories whose start point is at range strictly less than distance of p and whose
+	// end point is at range strictly less than distance of end, does not return the query point if present
 	void neighborsWithCallback(Vertex &p, Vertex& end, double eps, std::vector<Trajectory*> &trajectories, const std::function< void(Trajectory*) >& emit) {
-		int* limitsX = slotsTouched(p.x - eps, p.x + eps, 'x');
-		int* limitsY = slotsTouched(p.y - eps, p.y + eps, 'y');
-
-		for (int i = limitsX[0]; i <= limitsX[1]; i++) {
-			for (int j = limitsY[0]; j <= limitsY[1]; j++) {
-				for (Vertex &pActual : elements[i][j]) {
-					if (pActual.isStart == p.isStart) {
-						double dx = p.x - pActual.x;
-						double dy = p.y - pActual.y;
-						double distSQ = dx * dx + dy * dy;
-						if (distSQ < eps * eps) {
-							Trajectory *t = trajectories[pActual.trajectoryNumber];
-							Vertex &pend = t->vertices[t->size - 1];
-							double dex = end.x - pend.x;
-							double dey = end.y - pend.y;
-							double disteSQ = dex * dex + dey * dey;
-							if (disteSQ < eps * eps) {
-								emit(t);
-							}
-						}
-					}
+		double epsSQ = eps * eps;
+
+		forEachRun(grid, p, eps, [&](int first, int last) {
+			for (int k = first; k < last; k++) {
+				double dx = p.x - grid.xs[k];
+				double dy = p.y - grid.ys[k];
+				double dex = end.x - grid.exs[k];
+				double dey = end.y - grid.eys[k];
+				if (dx * dx + dy * dy < epsSQ && dex * dex + dey * dey < epsSQ) {
+					emit(trajectories[grid.ids[k]]);
 				}
-
 			}
-		}
-		delete[] limitsX;
-		delete[] limitsY;
+		});
 	}
 	
 
 
-	~DiHash();
+	~DiHash() {}
 };
 
@@ -6,25 +6,24 @@
 // Does binary search on integer range (lowerbound, upperbound),
 // accepts lambda function returning whether the given search index
 // satisfies the search criterion.
-int binaryIntSearch(const std::function< bool(int) >& f, int upperbound, int lowerbound) {
-	int rangeLength = upperbound - lowerbound;
-	if (rangeLength <= 1) {
-		return lowerbound;
-	}
-	int middle = lowerbound + (rangeLength) / 2;
-	bool result = f(middle);
-	if (result) {
-		return binaryIntSearch(f, upperbound, middle);
-	}
-	else {
-		return binaryIntSearch(f, middle, lowerbound);
+template<typename F>
+int binaryIntSearch(F &f, int upperbound, int lowerbound) {
+	while (upperbound - lowerbound > 1) {
+		int middle = lowerbound + (upperbound - lowerbound) / 2;
+		if (f(middle)) {
+			lowerbound = middle;
+		}
+		else {
+			upperbound = middle;
+		}
 	}
+	return lowerbound;
 }
 
 // does binary search on double range (lowerbound, upperbound),
 // accepts lambda function returning whether the given search index
 // satisfies the search criterion.
-void binaryDoubleSearch(const std::function< int(double) >& f, double upperbound, double lowerbound) {
+inline void binaryDoubleSearch(const std::function< int(double) >& f, double upperbound, double lowerbound) {
 	double rangeLength = upperbound - lowerbound;
 	double avg = lowerbound + (rangeLength) / 2;
 	int result = f(avg);
@@ -43,7 +42,9 @@ void binaryDoubleSearch(const std::function< int(double) >& f, double upperbound
 // Does double & search on integer range (lowerbound, upperbound),
 // accepts lambda function returning whether the given search index
 // satisfies the search criterion.
-int doubleNsearch(const std::function< bool(int) >& f, int start, int end, int doubleNSearchBase, double doubleNSearchExponentStep) {
+// Templated on the lambda so every probe can be inlined.
+template<typename F>
+int doubleNsearch(F f, int start, int end, int doubleNSearchBase, double doubleNSearchExponentStep) {
 	int k = start;
 	int prevk = start;
 	int iteration = 0;
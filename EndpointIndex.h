@@ -0,0 +1,93 @@
+#pragma once
+
+#include "Vertex.h"
+#include "Trajectory.h"
+
+#include <vector>
+#include <algorithm>
+#include <functional>
+
+// Static kd-tree over the combined (start x, start y, end x, end y) key of each trajectory.
+// Answers the start AND end point range query inside the index, so the query
+// step never has to look into Trajectory objects to reject a candidate.
+// Entries are stored in one contiguous array in implicit kd-tree order:
+// the node of range [lo, hi) is entry (lo + hi) / 2, split on dimension depth % 4.
+class EndpointIndex
+{
+public:
+	struct Entry {
+		double key[4]; // sx, sy, ex, ey
+		int trajectoryNumber;
+	};
+
+	// ranges at most this size are scanned linearly instead of split further
+	int leafSize = 8;
+
+	std::vector<Entry> entries;
+
+	void addTrajectory(Vertex &start, Vertex &end, int trajectoryNumber) {
+		Entry e;
+		e.key[0] = start.x;
+		e.key[1] = start.y;
+		e.key[2] = end.x;
+		e.key[3] = end.y;
+		e.trajectoryNumber = trajectoryNumber;
+		entries.push_back(e);
+	}
+
+	// must be called after all trajectories are added, and before querying
+	void build() {
+		build(0, entries.size(), 0);
+	}
+
+	// Emits trajectories whose start is strictly within eps of start and end strictly within eps of end
+	void neighborsWithCallback(Vertex &start, Vertex &end, double eps, std::vector<Trajectory*> &trajectories, const std::function< void(Trajectory*) >& emit) {
+		double q[4] = { start.x, start.y, end.x, end.y };
+		search(0, entries.size(), 0, q, eps, trajectories, emit);
+	}
+
+private:
+	void build(int lo, int hi, int depth) {
+		if (hi - lo <= leafSize) return;
+		int mid = (lo + hi) / 2;
+		int dim = depth % 4;
+		std::nth_element(entries.begin() + lo, entries.begin() + mid, entries.begin() + hi,
+			[dim](const Entry &a, const Entry &b) -> bool { return a.key[dim] < b.key[dim]; });
+		build(lo, mid, depth + 1);
+		build(mid + 1, hi, depth + 1);
+	}
+
+	inline bool matches(Entry &e, double *q, double epsSQ) {
+		double dx = e.key[0] - q[0];
+		double dy = e.key[1] - q[1];
+		if (dx * dx + dy * dy >= epsSQ) return false;
+		dx = e.key[2] - q[2];
+		dy = e.key[3] - q[3];
+		return dx * dx + dy * dy < epsSQ;
+	}
+
+	void search(int lo, int hi, int depth, double *q, double eps, std::vector<Trajectory*> &trajectories, const std::function< void(Trajectory*) >& emit) {
+		double epsSQ = eps * eps;
+		if (hi - lo <= leafSize) {
+			for (int i = lo; i < hi; i++) {
+				if (matches(entries[i], q, epsSQ)) {
+					emit(trajectories[entries[i].trajectoryNumber]);
+				}
+			}
+			return;
+		}
+		int mid = (lo + hi) / 2;
+		int dim = depth % 4;
+		double split = entries[mid].key[dim];
+		if (matches(entries[mid], q, epsSQ)) {
+			emit(trajectories[entries[mid].trajectoryNumber]);
+		}
+		// the box around the query key is [q - eps, q + eps] in every dimension
+		if (q[dim] - eps <= split) {
+			search(lo, mid, depth + 1, q, eps, trajectories, emit);
+		}
+		if (q[dim] + eps >= split) {
+			search(mid + 1, hi, depth + 1, q, eps, trajectories, emit);
+		}
+	}
+};
@@ -12,11 +12,12 @@
 // The ETD algorithm computes an approximation of frechet distance by
 // taking the 'dog leash' length when traversing two trajectories at 
 // the same speed. Used by agarwal and simplification step.
+// Reads segment deltas and reciprocal lengths from the precomputed segment tables.
 // If found relevant, this function can be optimized using SIMD instructions
 static double equalTimeDistance(
-	std::vector<Vertex> &pverts, std::vector<Vertex> &qverts,
-	std::vector<double> &ptotals, std::vector<double> &qtotals,
-	std::vector<double> &pdistances, std::vector<double> &qdistances,
+	Vertex *pverts, Vertex *qverts,
+	double *ptotals, double *qtotals,
+	Segment *psegs, Segment *qsegs,
 	int psize, int qsize,
 	int pstart, int qstart) {
 
@@ -65,9 +66,10 @@ static double equalTimeDistance(
 			p_pt.x = pverts[p_ptr].x;
 			p_pt.y = pverts[p_ptr].y;
 			position = (ptotals[p_ptr] - pdistOffset) / pdist;
-			double scale = (position * qdist - (qtotals[q_ptr - 1] - qdistOffset)) / qdistances[q_ptr];
-			dx = qverts[q_ptr].x - qverts[q_ptr - 1].x;
-			dy = qverts[q_ptr].y - qverts[q_ptr - 1].y;
+			Segment &qs = qsegs[q_ptr - 1];
+			double scale = (position * qdist - (qtotals[q_ptr - 1] - qdistOffset)) * qs.invLength;
+			dx = qs.dx;
+			dy = qs.dy;
 			q_pt.x = qverts[q_ptr - 1].x + dx * scale;
 			q_pt.y = qverts[q_ptr - 1].y + dy * scale;
 			p_ptr++;
@@ -76,9 +78,10 @@ static double equalTimeDistance(
 			q_pt.x = qverts[q_ptr].x;
 			q_pt.y = qverts[q_ptr].y;
 			position = (qtotals[q_ptr] - qdistOffset) / qdist;
-			double scale = (position * pdist - (ptotals[p_ptr - 1] - pdistOffset)) / pdistances[p_ptr];
-			dx = pverts[p_ptr].x - pverts[p_ptr - 1].x;
-			dy = pverts[p_ptr].y - pverts[p_ptr - 1].y;
+			Segment &ps = psegs[p_ptr - 1];
+			double scale = (position * pdist - (ptotals[p_ptr - 1] - pdistOffset)) * ps.invLength;
+			dx = ps.dx;
+			dy = ps.dy;
 			p_pt.x = pverts[p_ptr - 1].x + dx * scale;
 			p_pt.y = pverts[p_ptr - 1].y + dy * scale;
 			q_ptr++;
@@ -106,6 +109,40 @@ static double equalTimeDistance(
 	return sqrt(smax);
 }
 
-double equalTimeDistance(Trajectory &p, Trajectory &q) {
-	return equalTimeDistance(p.vertices, q.vertices, p.totals, q.totals, p.distances, q.distances, p.size, q.size, 0, 0);
+inline double equalTimeDistance(Trajectory &p, Trajectory &q) {
+	return equalTimeDistance(p.vertices.data(), q.vertices.data(), p.totals.data(), q.totals.data(), p.segments.data(), q.segments.data(), p.size, q.size, 0, 0);
+}
+
+// Equal time distance between the subtrajectory pverts[pstart] to pverts[pend] and the segment (a, b), squared.
+// The segment has no inner vertices, so the leash is longest at a vertex of the subtrajectory, where it is
+// matched to the point of the segment at the same fraction of the length. Returns as soon as the distance
+// exceeds limitSQ, use DBL_MAX for the exact value.
+static double segmentEqualTimeDistanceSQ(
+	Vertex *pverts, double *ptotals,
+	int pstart, int pend,
+	Vertex &a, Vertex &b, double limitSQ) {
+
+	double dx = pverts[pstart].x - a.x;
+	double dy = pverts[pstart].y - a.y;
+	double smax = dx*dx + dy*dy;
+	dx = pverts[pend].x - b.x;
+	dy = pverts[pend].y - b.y;
+	smax = std::max(smax, dx*dx + dy*dy);
+	double pdistOffset = ptotals[pstart];
+	double pdist = ptotals[pend] - pdistOffset;
+	double sx = b.x - a.x;
+	double sy = b.y - a.y;
+	if (pdist == 0 || (sx == 0 && sy == 0) || smax > limitSQ) return smax;
+	double invLength = 1 / pdist;
+	for (int j = pstart + 1; j < pend; j++) {
+		double position = (ptotals[j] - pdistOffset) * invLength;
+		dx = pverts[j].x - (a.x + sx * position);
+		dy = pverts[j].y - (a.y + sy * position);
+		double nm = dx*dx + dy*dy;
+		if (nm > smax) {
+			smax = nm;
+			if (smax > limitSQ) return smax;
+		}
+	}
+	return smax;
 }
@@ -4,6 +4,7 @@
 
 #include "Trajectory.h"
 #include "Query.h"
+#include "PackedDataset.h"
 #include "Settings.h"
 
 #include <string>
@@ -13,19 +14,35 @@
 #include <sstream>
 #include <math.h>
 #include <iomanip>
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <cstdlib>
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 
 class FileIO {
 	std::vector<Vertex> vertexBuffer;
 	std::vector<double> distanceBuffer;
 	std::vector<double> totalBuffer;
 	std::vector<int> sourceIndex;
+	// file contents, where files are read instead of memory mapped
+	std::vector<char> readBuffer;
+	// the container the dataset was loaded from, nullptr when it was loaded from separate files.
+	// Owned by the FileIO that opened it, other FileIOs only share it (see sharePackedDataset).
+	PackedDataset *packedDataset = nullptr;
+	bool ownsPackedDataset = false;
 
 
 public:
 
 	// Parses trajectory file, also computes trajectory metrics
 	// TODO: move temporary buffer allocation out of function
-	Trajectory* parseTrajectoryFileStreams(std::string filename, int trajectoryNumber) {
+	Trajectory* parseTrajectoryFileStreams(std::string filename, int trajectoryNumber, Arena &arena) {
 		std::ifstream infile(filename);
 
 
@@ -45,21 +62,16 @@ public:
 		distanceBuffer.push_back(0);
 		totalBuffer.push_back(0);
 
-		BoundingBox *b = new BoundingBox();
-
-		bool start = true;
-
 		Trajectory *t = new Trajectory();
 		t->name = filename;
+		t->uniqueIDInDataset = trajectoryNumber;
+		BoundingBox *b = &t->boundingBox;
 		Vertex v;
 
 		while (infile >> x >> y >> z >> w)
 		{
 			v.x = x;
 			v.y = y;
-			v.trajectoryNumber = trajectoryNumber;
-			v.isStart = start;
-			start = false;
 			//update boundingbox
 			b->addPoint(v.x, v.y);
 			if (vertexBuffer.empty()) {
@@ -85,158 +97,369 @@ public:
 
 		t->size = vertexBuffer.size();
 		t->totalLength = totalBuffer[t->size - 1];
-		t->boundingBox = b;
 
-		t->vertices = vertexBuffer;
-		t->distances = distanceBuffer;
-		t->totals = totalBuffer;
-		t->sourceIndex = sourceIndex;
+		t->vertices.assign(arena, vertexBuffer);
+		t->distances.assign(arena, distanceBuffer);
+		t->totals.assign(arena, totalBuffer);
+		t->sourceIndex.assign(arena, sourceIndex);
+		t->computeSegments(arena);
 
 
 
 		return t;
 	}
 
-	#define BUFFER_SIZE (1024 * 1024)//1Mb
-	#define READ_SIZE (1024 * 5)//5kb
-
-	//std::vector<char> buffer = std::vector<char>(BUFFER_SIZE);
-	char* buffer = nullptr;
-	Trajectory* parseTrajectoryFileFast(std::string filename, int trajectoryNumber) {
-		if (buffer == nullptr) {
-			buffer = new char[BUFFER_SIZE];
-		}
-#if USE_FOPEN_S
-		FILE* file;
-		int err = fopen_s(&file, filename.c_str(), "rb");
-		if (err != 0) {
-			std::cout << "Failed to open (fopens): " << filename << "\n";
-			exit(1);
-		}
-#else
+	// Maps a whole file into memory, or reads it into buffer where mmap is not available.
+	// Returns nullptr if the file cannot be opened.
+	static const char* mapFile(const std::string &filename, size_t &size, std::vector<char> &buffer) {
+#ifdef _WIN32
 		FILE* file = fopen(filename.c_str(), "rb");
-		if (file == NULL) {
-			std::cout << "Failed to open (fopen): " << filename << "\n";
-			exit(1);
+		if (file == NULL) return nullptr;
+		fseek(file, 0, SEEK_END);
+		size = ftell(file);
+		fseek(file, 0, SEEK_SET);
+		buffer.resize(size + 1);
+		size = fread(buffer.data(), 1, size, file);
+		fclose(file);
+		return buffer.data();
+#else
+		(void)buffer;// only read into where mmap is not available
+		int fd = open(filename.c_str(), O_RDONLY);
+		if (fd < 0) return nullptr;
+		struct stat st;
+		if (fstat(fd, &st) != 0) {
+			close(fd);
+			return nullptr;
 		}
+		size = st.st_size;
+		if (size == 0) {
+			close(fd);
+			return "";
+		}
+		void *data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+		close(fd);
+		if (data == MAP_FAILED) return nullptr;
+		madvise(data, size, MADV_SEQUENTIAL);
+		return (const char*)data;
 #endif
+	}
 
+	static void unmapFile(const char *data, size_t size) {
+#ifndef _WIN32
+		if (size > 0) munmap((void*)data, size);
+#endif
+	}
 
-		double x, y, z, w;
-		vertexBuffer.clear();
-		distanceBuffer.clear();
-		totalBuffer.clear();
-		sourceIndex.clear();
-
-		distanceBuffer.push_back(0);
-		totalBuffer.push_back(0);
-
-		BoundingBox *b = new BoundingBox();
-
-		bool start = true;
-
-		Trajectory *t = new Trajectory();
-		t->name = filename;
-		Vertex v;
-
-		int line = 0;
-
-		int offset = 0;
-		int reads = 0;
-
-		while (true)
-		{
-			size_t readLength = fread(&buffer[READ_SIZE*reads], 1, READ_SIZE, file);
-			reads++;
-			while (true) {
-				if (offset == readLength) break;
-				line++;
-				int eol = -1;
-				for (int i = offset; i < offset + readLength; i++) {
-					if (buffer[i] == '\n') {
-						eol = i;
-						break;
-					}
-				}
-				int prevOffset = offset;
-				int nextOffset = eol + 1;
-				if (eol == -1) break;
-				if (line == 1) {
-					offset = eol + 1;
-					continue;
-				}
-				// vertex from 0 to nl
-				int space = -1;
-				for (int i = offset; i < eol; i++) {
-					if (buffer[i] == ' ') {
-						space = i;
-						break;
-					}
-				}
-				offset = nextOffset;
-				if (space == -1 || space == prevOffset) break;// bad line
-				char* pEnd;
-				double x = strtod(&buffer[prevOffset], &pEnd);
-				double y = strtod(pEnd, NULL);
-				v.x = x;
-				v.y = y;
-				v.trajectoryNumber = trajectoryNumber;
-				v.isStart = start; start = false;
-				//update boundingbox
-				b->addPoint(v.x, v.y);
-				if (vertexBuffer.empty()) {
-					vertexBuffer.push_back(v);
-					sourceIndex.push_back(sourceIndex.size());
+	// Parses a decimal floating point number at p, skipping leading spaces, and moves p past it.
+	// Numbers with at most 19 significant digits whose mantissa and power of ten are both exact
+	// doubles are converted with a single multiplication or division, which rounds correctly.
+	// All other numbers are handed to strtod.
+	static bool parseDouble(const char *&p, const char *end, double &value) {
+		static const double powersOfTen[] = {
+			1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10,
+			1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+		};
+		while (p < end && (*p == ' ' || *p == '\t')) p++;
+		const char *start = p;
+		bool negative = false;
+		if (p < end && (*p == '-' || *p == '+')) {
+			negative = *p == '-';
+			p++;
+		}
+		unsigned long long mantissa = 0;
+		int digits = 0;
+		int exponent = 0;
+		bool exact = true;
+		bool any = false;
+		for (; p < end && *p >= '0' && *p <= '9'; p++) {
+			any = true;
+			if (digits < 19) {
+				mantissa = mantissa * 10 + (*p - '0');
+				if (mantissa > 0) digits++;
+			}
+			else {
+				exponent++;
+				exact = false;
+			}
+		}
+		if (p < end && *p == '.') {
+			p++;
+			for (; p < end && *p >= '0' && *p <= '9'; p++) {
+				any = true;
+				if (digits < 19) {
+					mantissa = mantissa * 10 + (*p - '0');
+					if (mantissa > 0) digits++;
+					exponent--;
 				}
 				else {
-					// ignore duplicate verts, they are annoying
-					int prevIndex = vertexBuffer.size() - 1;
-					Vertex &prev = vertexBuffer[prevIndex];
-					if (prev.x != v.x || prev.y != v.y) {
-						double dx = v.x - prev.x;
-						double dy = v.y - prev.y;
-						double dist = sqrt(dx*dx + dy*dy);
-						distanceBuffer.push_back(dist);
-						totalBuffer.push_back(totalBuffer[prevIndex] + dist);
-						vertexBuffer.push_back(v);
-						sourceIndex.push_back(sourceIndex.size());
-					}
+					exact = false;
 				}
 			}
-
-			//EOF
-			if (readLength != BUFFER_SIZE) {
-				break;
+		}
+		if (!any) {
+			p = start;
+			return false;
+		}
+		if (p < end && (*p == 'e' || *p == 'E')) {
+			const char *e = p + 1;
+			bool negativeExponent = false;
+			if (e < end && (*e == '-' || *e == '+')) {
+				negativeExponent = *e == '-';
+				e++;
+			}
+			if (e < end && *e >= '0' && *e <= '9') {
+				int value = 0;
+				for (; e < end && *e >= '0' && *e <= '9'; e++) {
+					if (value < 100000) value = value * 10 + (*e - '0');
+				}
+				exponent += negativeExponent ? -value : value;
+				p = e;
 			}
 		}
-		fclose(file);
+		if (exact && mantissa <= (1ULL << 53) && exponent >= -22 && exponent <= 22) {
+			value = (double)mantissa;
+			value = exponent < 0 ? value / powersOfTen[-exponent] : value * powersOfTen[exponent];
+		}
+		else {
+			std::string token(start, p - start);
+			value = strtod(token.c_str(), NULL);
+			return true;
+		}
+		if (negative) value = -value;
+		return true;
+	}
 
+	// Parses a trajectory file from a memory mapping, also computes trajectory metrics.
+	// The number of lines bounds the number of vertices, so the vertex data is written
+	// directly into its arena storage, which is shrunk to the vertices actually read.
+	Trajectory* parseTrajectoryFileFast(std::string filename, int trajectoryNumber, Arena &arena) {
+		size_t size = 0;
+		const char *data = mapFile(filename, size, readBuffer);
+		if (data == nullptr) {
+			std::cout << "Failed to open: " << filename << "\n";
+			exit(1);
+		}
+		const char *end = data + size;
+
+		// skip the header
+		const char *p = (const char*)memchr(data, '\n', size);
+		p = p == nullptr ? end : p + 1;
+		int maxVertices = 1;
+		for (const char *c = p; (c = (const char*)memchr(c, '\n', end - c)) != nullptr; c++) {
+			maxVertices++;
+		}
 
-		t->size = vertexBuffer.size();
-		t->totalLength = totalBuffer[t->size - 1];
-		t->boundingBox = b;
+		Trajectory *t = new Trajectory();
+		t->name = filename;
+		t->uniqueIDInDataset = trajectoryNumber;
+		BoundingBox *b = &t->boundingBox;
+		t->vertices.allocate(arena, maxVertices);
+		t->distances.allocate(arena, maxVertices);
+		t->totals.allocate(arena, maxVertices);
+		t->sourceIndex.allocate(arena, maxVertices);
+		Vertex *vertices = t->vertices.data();
+		double *distances = t->distances.data();
+		double *totals = t->totals.data();
+		int *sourceIndex = t->sourceIndex.data();
+
+		int n = 0;
+		Vertex v;
+		while (p < end) {
+			const char *eol = (const char*)memchr(p, '\n', end - p);
+			if (eol == nullptr) eol = end;
+			if (!parseDouble(p, eol, v.x) || !parseDouble(p, eol, v.y)) break;// bad line
+			p = eol + 1;
+			//update boundingbox
+			b->addPoint(v.x, v.y);
+			if (n == 0) {
+				vertices[0] = v;
+				distances[0] = 0;
+				totals[0] = 0;
+				sourceIndex[0] = 0;
+				n++;
+			}
+			else {
+				// ignore duplicate verts, they are annoying
+				Vertex &prev = vertices[n - 1];
+				if (prev.x != v.x || prev.y != v.y) {
+					double dx = v.x - prev.x;
+					double dy = v.y - prev.y;
+					double dist = sqrt(dx*dx + dy*dy);
+					vertices[n] = v;
+					distances[n] = dist;
+					totals[n] = totals[n - 1] + dist;
+					sourceIndex[n] = n;
+					n++;
+				}
+			}
+		}
+		unmapFile(data, size);
 
-		t->vertices = vertexBuffer;
-		t->distances = distanceBuffer;
-		t->totals = totalBuffer;
-		t->sourceIndex = sourceIndex;
+		t->size = n;
+		t->totalLength = n > 0 ? totals[n - 1] : 0;
+		t->vertices.shrink(n);
+		t->distances.shrink(n);
+		t->totals.shrink(n);
+		t->sourceIndex.shrink(n);
+		t->computeSegments(arena);
 
+		return t;
+	}
 
+	// Builds trajectory i of the packed dataset, the vertices are used in place, the
+	// metrics are computed into arena
+	Trajectory* parsePackedTrajectory(int i, std::string filename, int trajectoryNumber, Arena &arena) {
+		Trajectory *t = new Trajectory();
+		t->name = filename;
+		t->uniqueIDInDataset = trajectoryNumber;
+		int n = packedDataset->entry(i).vertexCount;
+		t->size = n;
+		t->vertices.view(packedDataset->vertices(i), n);
+		t->distances.allocate(arena, n);
+		t->totals.allocate(arena, n);
+		t->sourceIndex.allocate(arena, n);
+		BoundingBox *b = &t->boundingBox;
+		for (int j = 0; j < n; j++) {
+			Vertex &v = t->vertices[j];
+			b->addPoint(v.x, v.y);
+			t->sourceIndex[j] = j;
+			if (j == 0) {
+				t->distances[0] = 0;
+				t->totals[0] = 0;
+			}
+			else {
+				double dx = v.x - t->vertices[j - 1].x;
+				double dy = v.y - t->vertices[j - 1].y;
+				t->distances[j] = sqrt(dx*dx + dy*dy);
+				t->totals[j] = t->totals[j - 1] + t->distances[j];
+			}
+		}
+		t->totalLength = n > 0 ? t->totals[n - 1] : 0;
+		t->computeSegments(arena);
+		return t;
+	}
 
+	// Builds a trajectory from vertices in memory (for example sent by a client), like a parsed
+	// file: duplicate vertices are skipped and the data is allocated from arena
+	Trajectory* makeTrajectory(const std::vector<Vertex> &points, std::string name, int trajectoryNumber, Arena &arena) {
+		Trajectory *t = new Trajectory();
+		t->name = name;
+		t->uniqueIDInDataset = trajectoryNumber;
+		int maxVertices = std::max(1, (int)points.size());
+		t->vertices.allocate(arena, maxVertices);
+		t->distances.allocate(arena, maxVertices);
+		t->totals.allocate(arena, maxVertices);
+		t->sourceIndex.allocate(arena, maxVertices);
+		int n = 0;
+		for (const Vertex &v : points) {
+			if (n > 0 && t->vertices[n - 1].x == v.x && t->vertices[n - 1].y == v.y) continue;
+			t->boundingBox.addPoint(v.x, v.y);
+			t->vertices[n] = v;
+			if (n == 0) {
+				t->distances[0] = 0;
+				t->totals[0] = 0;
+			}
+			else {
+				double dx = v.x - t->vertices[n - 1].x;
+				double dy = v.y - t->vertices[n - 1].y;
+				t->distances[n] = sqrt(dx*dx + dy*dy);
+				t->totals[n] = t->totals[n - 1] + t->distances[n];
+			}
+			t->sourceIndex[n] = n;
+			n++;
+		}
+		t->size = n;
+		t->totalLength = n > 0 ? t->totals[n - 1] : 0;
+		t->vertices.shrink(n);
+		t->distances.shrink(n);
+		t->totals.shrink(n);
+		t->sourceIndex.shrink(n);
+		t->computeSegments(arena);
 		return t;
 	}
 
-	// delegating function for file loading
-	Trajectory* parseTrajectoryFile(std::string filename, int trajectoryNumber) {
+	// true if the trajectory file can be loaded, from the packed dataset or from disk
+	bool trajectoryExists(const std::string &filename) {
+		if (packedDataset != nullptr && packedDataset->find(filename) != -1) {
+			return true;
+		}
+		FILE *file = fopen((TRAJECTORY_FILES_OFFSET + filename).c_str(), "rb");
+		if (file == NULL) return false;
+		fclose(file);
+		return true;
+	}
+
+	// delegating function for file loading, the trajectory data is allocated from arena
+	// Trajectories in the packed dataset are taken from there, others are read from their file.
+	Trajectory* parseTrajectoryFile(std::string filename, int trajectoryNumber, Arena &arena) {
+		if (packedDataset != nullptr) {
+			int i = packedDataset->find(filename);
+			if (i != -1) {
+				return parsePackedTrajectory(i, TRAJECTORY_FILES_OFFSET + filename, trajectoryNumber, arena);
+			}
+		}
 		#if USE_FAST_IO
-			return parseTrajectoryFileFast(TRAJECTORY_FILES_OFFSET + filename, trajectoryNumber);
+			return parseTrajectoryFileFast(TRAJECTORY_FILES_OFFSET + filename, trajectoryNumber, arena);
 		#else
-			return parseTrajectoryFileStreams(TRAJECTORY_FILES_OFFSET + filename, trajectoryNumber);
+			return parseTrajectoryFileStreams(TRAJECTORY_FILES_OFFSET + filename, trajectoryNumber, arena);
 		#endif
 	}
 
 
+	// Reads only the first and last vertex of a trajectory file, and estimates the number of vertices
+	// from the file size. Used to estimate query costs without parsing the whole file.
+	bool peekTrajectoryFile(std::string filename, Vertex &start, Vertex &end, int &estimatedSize) {
+		if (packedDataset != nullptr) {
+			int i = packedDataset->find(filename);
+			if (i != -1) {
+				estimatedSize = packedDataset->entry(i).vertexCount;
+				if (estimatedSize == 0) return false;
+				start = packedDataset->vertices(i)[0];
+				end = packedDataset->vertices(i)[estimatedSize - 1];
+				return true;
+			}
+		}
+		FILE* file = fopen((TRAJECTORY_FILES_OFFSET + filename).c_str(), "rb");
+		if (file == NULL) {
+			return false;
+		}
+		char head[512];
+		char tail[512];
+		size_t headLength = fread(head, 1, sizeof(head) - 1, file);
+		head[headLength] = 0;
+		fseek(file, 0, SEEK_END);
+		long fileSize = ftell(file);
+		long tailStart = std::max(0L, fileSize - (long)(sizeof(tail) - 1));
+		fseek(file, tailStart, SEEK_SET);
+		size_t tailLength = fread(tail, 1, fileSize - tailStart, file);
+		tail[tailLength] = 0;
+		fclose(file);
+
+		// first vertex is on the line after the header
+		char *first = strchr(head, '\n');
+		if (first == NULL) return false;
+		first++;
+		char *firstEnd = strchr(first, '\n');
+		if (firstEnd == NULL) return false;
+		char *pEnd;
+		start.x = strtod(first, &pEnd);
+		start.y = strtod(pEnd, NULL);
+
+		// last vertex is on the last non-empty line
+		int i = tailLength - 1;
+		while (i >= 0 && (tail[i] == '\n' || tail[i] == '\r')) i--;
+		while (i >= 0 && tail[i] != '\n') i--;
+		if (i < 0 && tailStart > 0) return false;
+		end.x = strtod(&tail[i + 1], &pEnd);
+		end.y = strtod(pEnd, NULL);
+
+		long lineLength = firstEnd - first + 1;
+		estimatedSize = (int)((fileSize - (first - head)) / lineLength);
+		return true;
+	}
+
 	// Parses query file, does not load query trajectories
+	// A line is either a range query "file delta" or a k nearest neighbour query "file knn k"
 	std::vector<Query>* parseQueryFile(char* filename) {
 		std::ifstream infile(filename);
 
@@ -245,17 +468,38 @@ public:
 			exit(1);
 		}
 
-		double eps;
+		std::string line;
 		std::string queryTrajectoryFileName;
+		std::string parameter;
 
 		std::vector<Query> *queries = new std::vector<Query>;
 
 		int queryNumber = 0;
-		while (infile >> queryTrajectoryFileName >> eps) {
+		int lineNumber = 0;
+		while (std::getline(infile, line)) {
+			lineNumber++;
+			std::istringstream words(line);
+			if (!(words >> queryTrajectoryFileName >> parameter)) {
+				// empty line
+				continue;
+			}
 			Query q;
 			q.queryNumber = queryNumber;
-			q.queryDelta = eps;
 			q.queryTrajectoryFilename = queryTrajectoryFileName;
+			if (parameter == "knn") {
+				q.queryDelta = 0;
+				if (!(words >> q.knn) || q.knn <= 0) {
+					std::cout << "Bad knn query on line " << lineNumber << " of " << filename << "\n";
+					exit(1);
+				}
+			}
+			else {
+				std::istringstream delta(parameter);
+				if (!(delta >> q.queryDelta)) {
+					std::cout << "Bad query on line " << lineNumber << " of " << filename << "\n";
+					exit(1);
+				}
+			}
 
 			queries->push_back(q);
 			queryNumber++;
@@ -268,7 +512,12 @@ public:
 
 	// Parses dataset file, does not translate filenames based on dataset location
 	// This behavior is consistent with the conversations on the mailing list
+	// The dataset file is either a list of trajectory files, or a packed dataset (see PackedDataset.h),
+	// which is then used for every trajectory it contains.
 	std::vector<std::string>* parseDatasetFile(std::string filename) {
+		if (PackedDataset::isPacked(filename)) {
+			return openPackedDataset(filename);
+		}
 		std::ifstream infile(filename);
 
 		if (!infile.is_open()) {
@@ -288,35 +537,98 @@ public:
 		return trajectoryNames;
 	}
 
-	// Writes result trajectories for one query to a file called result-XXXXX.txt 
-	void writeQueryOutputFile(Query &q, std::vector<std::string> results) {
-		std::ostringstream stringStream;
-		stringStream << "result-" << std::setfill('0') << std::setw(5) << q.queryNumber << ".txt";
-		std::string filename = stringStream.str();
-		std::ofstream outfile(filename);
-
-		if (!outfile.is_open()) {
-			std::cout << "Failed to open: " << filename << "\n";
+	// Opens a packed dataset, and returns the names of the trajectories in the dataset.
+	// Replaces the container this FileIO opened before, if any.
+	std::vector<std::string>* openPackedDataset(std::string filename) {
+		PackedDataset *packed = new PackedDataset();
+		size_t size = 0;
+		const char *data = mapFile(filename, size, packed->storage);
+		if (data == nullptr || !packed->open(data, size)) {
+			std::cout << "Failed to open packed dataset: " << filename << "\n";
 			exit(1);
 		}
-
-		for (std::string trajectoryName : results) {
-			outfile << trajectoryName << "\n";
+		closePackedDataset();
+		packedDataset = packed;
+		ownsPackedDataset = true;
+		std::vector<std::string> *trajectoryNames = new std::vector<std::string>();
+		for (int i = 0; i < packed->count(); i++) {
+			if (packed->entry(i).flags & PackedDataset::IN_DATASET) {
+				trajectoryNames->push_back(packed->name(i));
+			}
 		}
-		outfile.close();
+		return trajectoryNames;
 	}
 
-	void writeQueryOutputFile(Query &q, std::string results) {
-		std::ostringstream stringStream;
-		stringStream << "result-" << std::setfill('0') << std::setw(5) << q.queryNumber << ".txt";
-		std::string filename = stringStream.str();
-		std::ofstream outfile(filename);
+	// Loads trajectories from the packed dataset opened by owner as well, used by the FileIO of every
+	// worker. owner must keep the container open as long as this FileIO uses it.
+	void sharePackedDataset(FileIO &owner) {
+		closePackedDataset();
+		packedDataset = owner.packedDataset;
+	}
 
-		if (!outfile.is_open()) {
+	// Unmaps the packed dataset if this FileIO opened it. Trajectories loaded from it point into
+	// the mapping, so they must be freed before.
+	void closePackedDataset() {
+		if (ownsPackedDataset) {
+			if (packedDataset->storage.empty()) {
+				unmapFile(packedDataset->data, packedDataset->size);
+			}
+			delete packedDataset;
+		}
+		packedDataset = nullptr;
+		ownsPackedDataset = false;
+	}
+
+	// Writes the trajectories of the dataset, and the extra (query) trajectories, to a packed dataset.
+	// The trajectories are parsed as usual, so the container holds them without duplicate vertices.
+	void writePackedDataset(std::vector<std::string> &datasetNames, std::vector<std::string> &extraNames, std::string filename) {
+		FILE *file = fopen(filename.c_str(), "wb");
+		if (file == NULL) {
 			std::cout << "Failed to open: " << filename << "\n";
 			exit(1);
 		}
-		outfile << results;
-		outfile.close();
+		PackedDataset::Header header;
+		memset(&header, 0, sizeof(header));
+		memcpy(header.magic, PackedDataset::magic(), 8);
+		header.version = PackedDataset::version;
+		fwrite(&header, sizeof(header), 1, file);
+		unsigned long long offset = sizeof(header);
+
+		std::vector<PackedDataset::Entry> entries;
+		std::string names;
+		Arena arena;
+		for (int k = 0; k < datasetNames.size() + extraNames.size(); k++) {
+			bool inDataset = k < datasetNames.size();
+			std::string &name = inDataset ? datasetNames[k] : extraNames[k - datasetNames.size()];
+			arena.reset();
+			Trajectory *t = parseTrajectoryFile(name, k, arena);
+			PackedDataset::Entry e;
+			memset(&e, 0, sizeof(e));
+			e.vertexOffset = offset;
+			e.vertexCount = t->size;
+			e.nameOffset = names.size();
+			e.nameLength = name.size();
+			e.flags = inDataset ? PackedDataset::IN_DATASET : 0;
+			entries.push_back(e);
+			names += name;
+			fwrite(t->vertices.data(), sizeof(Vertex), t->size, file);
+			offset += sizeof(Vertex) * t->size;
+			delete t;
+		}
+		header.count = entries.size();
+		header.directoryOffset = offset;
+		fwrite(entries.data(), sizeof(PackedDataset::Entry), entries.size(), file);
+		offset += sizeof(PackedDataset::Entry) * entries.size();
+		header.namesOffset = offset;
+		fwrite(names.data(), 1, names.size(), file);
+		offset += names.size();
+		header.size = offset;
+		fseek(file, 0, SEEK_SET);
+		fwrite(&header, sizeof(header), 1, file);
+		if (ferror(file)) {
+			std::cout << "Failed to write: " << filename << "\n";
+			exit(1);
+		}
+		fclose(file);
 	}
 };
\ No newline at end of file
@@ -0,0 +1,299 @@
+// Load test client for the query server (see QueryServer.h), sends the queries of a queryset file
+// over several connections and reports throughput and latencies
+#include "FileIO.h"
+#include "Query.h"
+#include "settings.h"
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <algorithm>
+#include <unordered_map>
+#include <iostream>
+#ifndef _WIN32
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+struct ClientData {
+	std::string socketPath;
+	std::vector<std::string> requests;// request lines without id
+	std::vector<int> queryNumbers;// query of every request
+	int connections = 4;
+	int window = 1;// requests a connection sends before waiting for an answer
+	FILE *output = NULL;
+	std::mutex outputMtx;
+	std::mutex statsMtx;
+	std::vector<double> latencies;// ms
+	long errors = 0;
+};
+
+#ifndef _WIN32
+int connectTo(const std::string &path) {
+	sockaddr_un address;
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path) - 1);
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0 || connect(fd, (sockaddr*)&address, sizeof(address)) != 0) {
+		std::cout << "Failed to connect to: " << path << "\n";
+		exit(1);
+	}
+	return fd;
+}
+
+void sendAll(int fd, const std::string &text) {
+	size_t sent = 0;
+	while (sent < text.size()) {
+		ssize_t n = write(fd, text.data() + sent, text.size() - sent);
+		if (n <= 0) {
+			std::cout << "Connection lost\n";
+			exit(1);
+		}
+		sent += n;
+	}
+}
+
+// Reads lines from a socket
+struct LineReader {
+	int fd;
+	std::string input;
+
+	bool next(std::string &line) {
+		while (true) {
+			size_t eol = input.find('\n');
+			if (eol != std::string::npos) {
+				line = input.substr(0, eol);
+				input.erase(0, eol + 1);
+				return true;
+			}
+			char buffer[65536];
+			ssize_t n = read(fd, buffer, sizeof(buffer));
+			if (n <= 0) return false;
+			input.append(buffer, n);
+		}
+	}
+};
+
+// Sends requests first, first + step, ... on its own connection, keeping at most window of them unanswered.
+// Requests are sent from a second thread while answers are read, because the server stops reading
+// requests while its queue is full, and only empties it once its answers are read.
+void client(ClientData *c, int first, int step) {
+	typedef std::chrono::steady_clock Clock;
+	int fd = connectTo(c->socketPath);
+	LineReader reader = { fd };
+	std::unordered_map<std::string, Clock::time_point> sent;
+	std::mutex sentMtx;
+	std::condition_variable answered;
+	int total = 0;
+	for (int i = first; i < c->requests.size(); i += step) {
+		total++;
+	}
+	std::thread sender([&]() -> void {
+		for (int next = first; next < c->requests.size(); next += step) {
+			std::string id = std::to_string(next);
+			{
+				std::unique_lock<std::mutex> lock(sentMtx);
+				answered.wait(lock, [&]() -> bool { return sent.size() < c->window; });
+				sent[id] = Clock::now();
+			}
+			sendAll(fd, id + " " + c->requests[next] + "\n");
+		}
+	});
+	std::vector<double> latencies;
+	long errors = 0;
+	std::string line;
+	std::string block;
+	for (int received = 0; received < total; received++) {
+		if (!reader.next(line)) {
+			std::cout << "Connection closed by the server\n";
+			exit(1);
+		}
+		char kind[16];
+		char id[64];
+		int count = 0;
+		Clock::time_point sentAt;
+		bool known = sscanf(line.c_str(), "%15s %63s %d", kind, id, &count) >= 2;
+		if (known) {
+			std::lock_guard<std::mutex> lock(sentMtx);
+			auto found = sent.find(id);
+			known = found != sent.end();
+			if (known) {
+				sentAt = found->second;
+			}
+		}
+		if (!known) {
+			std::cout << "Unexpected answer: " << line << "\n";
+			exit(1);
+		}
+		block.clear();
+		if (strcmp(kind, "query") == 0) {
+			for (int i = 0; i < count; i++) {
+				std::string result;
+				if (!reader.next(result)) {
+					std::cout << "Connection closed by the server\n";
+					exit(1);
+				}
+				block += result;
+				block += '\n';
+			}
+		}
+		else {
+			std::cout << line << "\n";
+			errors++;
+		}
+		latencies.push_back(std::chrono::duration<double, std::milli>(Clock::now() - sentAt).count());
+		{
+			std::lock_guard<std::mutex> lock(sentMtx);
+			sent.erase(id);
+		}
+		answered.notify_one();
+		if (c->output != NULL && strcmp(kind, "query") == 0) {
+			// same block as in results.txt, with the number of the query in the queryset
+			std::lock_guard<std::mutex> lock(c->outputMtx);
+			fprintf(c->output, "query %05d %d\n", c->queryNumbers[atoi(id)], count);
+			fwrite(block.data(), 1, block.size(), c->output);
+		}
+	}
+	sender.join();
+	close(fd);
+	std::lock_guard<std::mutex> lock(c->statsMtx);
+	c->latencies.insert(c->latencies.end(), latencies.begin(), latencies.end());
+	c->errors += errors;
+}
+#endif
+
+// Formats the vertices of a trajectory file as the inline points of a request
+std::string inlinePoints(FileIO &fio, const std::string &filename) {
+	Arena arena;
+	Trajectory *t = fio.parseTrajectoryFile(filename, -1, arena);
+	std::string points = "points";
+	char number[64];
+	for (int i = 0; i < t->size; i++) {
+		snprintf(number, sizeof(number), " %.17g %.17g", t->vertices[i].x, t->vertices[i].y);
+		points += number;
+	}
+	delete t;
+	return points;
+}
+
+int main(int argc, char *argv[])
+{
+	ClientData c;
+	std::vector<char*> files;
+	int repeat = 1;
+	bool sendInline = false;
+	bool shutdownServer = false;
+	std::string outputFile;
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		if (arg.compare(0, 2, "--") != 0) {
+			files.push_back(argv[i]);
+		}
+		else if (arg == "--connections" && i + 1 < argc) {
+			c.connections = std::max(1, atoi(argv[++i]));
+		}
+		else if (arg == "--window" && i + 1 < argc) {
+			c.window = std::max(1, atoi(argv[++i]));
+		}
+		else if (arg == "--repeat" && i + 1 < argc) {
+			repeat = std::max(1, atoi(argv[++i]));
+		}
+		else if (arg == "--inline") {
+			sendInline = true;
+		}
+		else if (arg == "--output" && i + 1 < argc) {
+			outputFile = argv[++i];
+		}
+		else if (arg == "--shutdown") {
+			shutdownServer = true;
+		}
+		else {
+			files.clear();
+			break;
+		}
+	}
+	if (files.size() != 2) {
+		std::cout << "Usage: " << argv[0] << " socket queryset.txt [--connections n] [--window n] [--repeat n] [--inline] [--output file] [--shutdown]\n";
+		return 1;
+	}
+	c.socketPath = files[0];
+
+	// the request of every query, trajectories sent inline are read once
+	FileIO fio;
+	std::vector<Query> *queries = fio.parseQueryFile(files[1]);
+	std::unordered_map<std::string, std::string> points;
+	std::vector<std::string> requests;
+	for (Query &q : *queries) {
+		std::string target = q.queryTrajectoryFilename;
+		if (sendInline) {
+			auto found = points.find(target);
+			if (found == points.end()) {
+				found = points.emplace(target, inlinePoints(fio, target)).first;
+			}
+			target = found->second;
+		}
+		std::ostringstream request;
+		request << std::setprecision(17);
+		if (q.knn > 0) {
+			request << "knn " << q.knn << " " << target;
+		}
+		else {
+			request << "range " << q.queryDelta << " " << target;
+		}
+		requests.push_back(request.str());
+	}
+	for (int r = 0; r < repeat; r++) {
+		for (int i = 0; i < queries->size(); i++) {
+			c.requests.push_back(requests[i]);
+			c.queryNumbers.push_back((*queries)[i].queryNumber);
+		}
+	}
+	if (!outputFile.empty()) {
+		c.output = fopen(outputFile.c_str(), "wb");
+		if (c.output == NULL) {
+			std::cout << "Failed to open: " << outputFile << "\n";
+			return 1;
+		}
+	}
+
+#ifndef _WIN32
+	auto started = std::chrono::steady_clock::now();
+	std::vector<std::thread*> threads;
+	for (int i = 0; i < c.connections; i++) {
+		threads.push_back(new std::thread(client, &c, i, c.connections));
+	}
+	for (std::thread *t : threads) {
+		t->join();
+		delete t;
+	}
+	double wallSec = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+	if (shutdownServer) {
+		int fd = connectTo(c.socketPath);
+		sendAll(fd, "shutdown\n");
+		close(fd);
+	}
+#else
+	std::cout << "Unix domain sockets are not supported on this platform\n";
+	return 1;
+#endif
+	if (c.output != NULL) {
+		fclose(c.output);
+	}
+
+	std::vector<double> &l = c.latencies;
+	std::sort(l.begin(), l.end());
+	auto percentile = [&](double p) -> double {
+		return l.empty() ? 0 : l[std::min(l.size() - 1, (size_t)(p * l.size()))];
+	};
+	std::cout << "Requests: " << l.size() << " (" << c.errors << " errors) over " << c.connections << " connections, window " << c.window << "\n";
+	std::cout << "Time: " << wallSec << " sec, " << (wallSec > 0 ? l.size() / wallSec : 0) << " requests/sec\n";
+	std::cout << "Latency ms: p50 " << percentile(0.5) << ", p90 " << percentile(0.9) << ", p99 " << percentile(0.99)
+		<< ", max " << (l.empty() ? 0 : l.back()) << "\n";
+	return c.errors > 0 ? 1 : 0;
+}
@@ -2,43 +2,159 @@
 // Also determines number of worker threads used by the algorithm
 #include "FileIO.h"
 #include "Algorithm.h"
+#include "QueryServer.h"
 #include "Query.h"
 #include "CDFQueued.h"
 #include "settings.h"
 
 #include <stdio.h>
 #include <thread>
+#include <vector>
+#include <string>
+#include <unordered_set>
+#include <cstring>
 
 
 
 int main(int argc, char *argv[])
 {
-	char * datasetFilename;
-	char * querysetFilename;
-	if (argc == 3) {
-		datasetFilename = argv[1];
-		querysetFilename = argv[2];
+	char * datasetFilename = "..\\dataset.txt";
+	char * querysetFilename = "..\\queries.txt";
+
+	// optional arguments, anywhere after the dataset and queryset files
+	std::string loadIndexFile;
+	std::string saveIndexFile;
+	int threads = 0;
+	double joinDelta = 0;
+	std::string joinOutputFile;
+	std::string packFile;
+	int prefetchDepth = -1;
+	std::string resultFile;
+	bool perQueryResults = false;
+	std::string servePath;
+	std::vector<char*> files;
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		if (arg.compare(0, 2, "--") != 0) {
+			files.push_back(argv[i]);
+		}
+		else if (arg == "--load-index" && i + 1 < argc) {
+			loadIndexFile = argv[++i];
+		}
+		else if (arg == "--save-index" && i + 1 < argc) {
+			saveIndexFile = argv[++i];
+		}
+		else if (arg == "--threads" && i + 1 < argc) {
+			threads = atoi(argv[++i]);
+		}
+		else if (arg == "--join" && i + 1 < argc) {
+			joinDelta = atof(argv[++i]);
+			if (joinDelta <= 0) {
+				std::cout << "Join delta must be positive: " << argv[i] << "\n";
+				return 1;
+			}
+		}
+		else if (arg == "--join-output" && i + 1 < argc) {
+			joinOutputFile = argv[++i];
+		}
+		else if (arg == "--prefetch" && i + 1 < argc) {
+			prefetchDepth = atoi(argv[++i]);
+		}
+		else if (arg == "--results" && i + 1 < argc) {
+			resultFile = argv[++i];
+		}
+		else if (arg == "--per-query-results") {
+			perQueryResults = true;
+		}
+		else if (arg == "--serve" && i + 1 < argc) {
+			servePath = argv[++i];
+		}
+		else if (arg == "--pack" && i + 1 < argc) {
+			packFile = argv[++i];
+		}
+		else {
+			std::cout << "Unknown argument: " << arg << "\n";
+			std::cout << "Usage: " << argv[0] << " dataset.txt queryset.txt [--save-index file] [--load-index file] [--threads n] [--prefetch depth]\n";
+			std::cout << "       " << std::string(strlen(argv[0]), ' ') << " [--results file | --per-query-results]\n";
+			std::cout << "       " << argv[0] << " dataset.txt --join eps [--join-output file] [--save-index file] [--load-index file] [--threads n]\n";
+			std::cout << "       " << argv[0] << " dataset.txt [queryset.txt] --pack dataset.pack\n";
+			std::cout << "       " << argv[0] << " dataset.txt --serve socket|- [--save-index file] [--load-index file] [--threads n]\n";
+			return 1;
+		}
 	}
-	else {
-		datasetFilename = "..\\dataset.txt";
-		querysetFilename = "..\\queries.txt";
+	if (files.size() >= 1) {
+		datasetFilename = files[0];
+	}
+	if (files.size() >= 2) {
+		querysetFilename = files[1];
 	}
 
 	long timeMS = std::chrono::system_clock::now().time_since_epoch() /
 		std::chrono::milliseconds(1);
 	
-	std::cout << "Dataset: " << datasetFilename << " Queryset: " << querysetFilename << "\n";
+	if (!packFile.empty()) {
+		// converts the dataset, and the query trajectories that are not in it, to a packed dataset
+		FileIO fio;
+		std::vector<std::string> *names = fio.parseDatasetFile(datasetFilename);
+		std::vector<std::string> extra;
+		if (files.size() >= 2) {
+			std::vector<Query> *queries = fio.parseQueryFile(querysetFilename);
+			std::unordered_set<std::string> seen(names->begin(), names->end());
+			for (Query &q : *queries) {
+				if (seen.insert(q.queryTrajectoryFilename).second) {
+					extra.push_back(q.queryTrajectoryFilename);
+				}
+			}
+		}
+		fio.writePackedDataset(*names, extra, packFile);
+		std::cout << "Packed " << names->size() << " dataset and " << extra.size() << " query trajectories into " << packFile << "\n";
+		return 0;
+	}
 
 	BoundingBox *box = new BoundingBox();
 
 	AlgoData a;
-	a.queries = a.fio.parseQueryFile(querysetFilename);
-	std::cout << "Loaded queries\n";
+	if (servePath == "-") {
+		// stdout carries the answers of the server
+		std::cout.rdbuf(std::cerr.rdbuf());
+	}
+	if (!servePath.empty()) {
+		// queries are sent by clients
+		std::cout << "Dataset: " << datasetFilename << " Serve: " << servePath << "\n";
+		a.queries = new std::vector<Query>();
+	}
+	else if (joinDelta > 0 && files.size() < 2) {
+		// self join without queries
+		std::cout << "Dataset: " << datasetFilename << " Join: " << joinDelta << "\n";
+		a.queries = new std::vector<Query>();
+	}
+	else {
+		std::cout << "Dataset: " << datasetFilename << " Queryset: " << querysetFilename << "\n";
+		a.queries = a.fio.parseQueryFile(querysetFilename);
+		std::cout << "Loaded queries\n";
+	}
+	a.joinDelta = joinDelta;
+	if (prefetchDepth >= 0) {
+		a.prefetchDepth = prefetchDepth;
+	}
+	if (!resultFile.empty()) {
+		a.resultFile = resultFile;
+	}
+	a.perQueryResults = perQueryResults;
+	if (!joinOutputFile.empty()) {
+		a.joinOutputFile = joinOutputFile;
+	}
 	a.trajectoryNames = a.fio.parseDatasetFile(datasetFilename);
 	a.numTrajectories = a.trajectoryNames->size();
 	std::cout << "Loaded trajectories\n";
 	a.numWorkers = std::thread::hardware_concurrency();// worker threads == number of logical cores
 	a.boundingBox = box;
+	a.loadIndexFile = loadIndexFile;
+	a.saveIndexFile = saveIndexFile;
+
+	if (threads > 0) {
+		a.numWorkers = threads;
+	}
 
 	#if !USE_MULTITHREAD
 		a.numWorkers = 1;
@@ -49,7 +165,12 @@ int main(int argc, char *argv[])
 
 	std::cout << "Num workers: " << a.numWorkers << "\n";
 
-	runAlgorithm(&a);
+	if (!servePath.empty()) {
+		runServer(&a, servePath);
+	}
+	else {
+		runAlgorithm(&a);
+	}
 
 	timeMS = std::chrono::system_clock::now().time_since_epoch() /
 		std::chrono::milliseconds(1) - timeMS;
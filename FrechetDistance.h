@@ -0,0 +1,107 @@
+#pragma once
+
+
+#include "Vertex.h"
+#include "Trajectory.h"
+#include "FrechetUtil.h"
+#include "CDFQDual.h"
+
+#include <algorithm>
+#include <vector>
+#include <cmath>
+
+
+
+// Computes the continuous frechet distance between two trajectories.
+// The distance is one of the critical values of the freespace diagram. Type A and B critical
+// values (endpoint distances and vertex-segment distances) are searched with the decision
+// procedure of CDFQDual. The remaining (type C) critical values lie between two consecutive
+// type B values, and are approximated by bisecting that interval down to a relative precision.
+class FrechetDistance {
+
+private:
+	CDFQDual decider;
+	std::vector<double> critical;
+
+	// relative width of the final bisection interval
+	double precision = 1e-12;
+
+	bool decide(Trajectory &P, Trajectory &Q, double eps) {
+		return decider.calculate(P, Q, 0, eps).high;
+	}
+
+	// distances from all vertices of P to all segments of Q within (lower, upper)
+	void addVertexSegmentDistances(Trajectory &P, Trajectory &Q, double lower, double upper) {
+		for (int i = 0; i < P.size; i++) {
+			Vertex &p = P.vertices[i];
+			for (int j = 0; j + 1 < Q.size; j++) {
+				Vertex &q = Q.vertices[j];
+				Segment &s = Q.segments[j];
+				// closest point on the segment
+				double t = 0;
+				if (s.lengthSQ > 0) {
+					t = ((p.x - q.x) * s.dx + (p.y - q.y) * s.dy) / s.lengthSQ;
+					t = clamp01(t);
+				}
+				double dx = q.x + t * s.dx - p.x;
+				double dy = q.y + t * s.dy - p.y;
+				double d = sqrt(dx * dx + dy * dy);
+				if (d > lower && d < upper) {
+					critical.push_back(d);
+				}
+			}
+		}
+	}
+
+public:
+
+	// Returns the frechet distance of P and Q, given a lower bound (for example the endpoint distance)
+	// and an upper bound (for example the equal time distance). If the distance is larger than upper,
+	// infinity is returned. upper must be finite.
+	double calculate(Trajectory &P, Trajectory &Q, double lower, double upper) {
+		// the distance is at least the distance between the endpoints
+		double startDist = sqrt(distSQ(P.vertices[0], Q.vertices[0]));
+		double endDist = sqrt(distSQ(P.vertices[P.size - 1], Q.vertices[Q.size - 1]));
+		lower = std::max(lower, std::max(startDist, endDist));
+		if (lower > upper || !decide(P, Q, upper)) {
+			return INFINITY;
+		}
+		if (decide(P, Q, lower)) {
+			return lower;
+		}
+
+		// smallest type B critical value for which the decision is yes
+		critical.clear();
+		addVertexSegmentDistances(P, Q, lower, upper);
+		addVertexSegmentDistances(Q, P, lower, upper);
+		critical.push_back(upper);
+		std::sort(critical.begin(), critical.end());
+		critical.erase(std::unique(critical.begin(), critical.end()), critical.end());
+		int lo = 0;
+		int hi = critical.size() - 1;// known yes
+		while (lo < hi) {
+			int mid = (lo + hi) / 2;
+			if (decide(P, Q, critical[mid])) {
+				hi = mid;
+			}
+			else {
+				lo = mid + 1;
+			}
+		}
+
+		// the distance is in (no, yes], bisect for a type C critical value
+		double no = hi > 0 ? critical[hi - 1] : lower;
+		double yes = critical[hi];
+		while (yes - no > precision * yes) {
+			double mid = no + (yes - no) / 2;
+			if (mid <= no || mid >= yes) break;
+			if (decide(P, Q, mid)) {
+				yes = mid;
+			}
+			else {
+				no = mid;
+			}
+		}
+		return yes;
+	}
+};
@@ -0,0 +1,234 @@
+// Embeddable frechet distance index over trajectories in memory, no files involved.
+// Include this instead of running the program on a dataset and a queryset file.
+#pragma once
+
+#include "FileIO.h"
+#include "Algorithm.h"
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <algorithm>
+
+// Preprocesses a set of trajectories once, then answers range and k nearest neighbour queries on
+// query trajectories given as points. All state lives in the index, so several indices can be used
+// in one process. Queries are solved by a thread pool owned by the index, with buffers per thread,
+// and may be called from several threads at once. Idle pool threads help deciding the candidates
+// of the queries being solved, so a single query uses the whole pool too.
+// build must not run concurrently with queries.
+//
+//   FrechetIndex index(8);
+//   index.build(trajectories);
+//   std::vector<int> close = index.rangeQuery(points, 0.5);
+class FrechetIndex {
+public:
+	// dataset index and frechet distance of a k nearest neighbour result
+	typedef std::pair<int, double> Neighbour;
+
+	// numThreads 0 -> one per logical core
+	FrechetIndex(int numThreads = 0) {
+		numWorkers = numThreads > 0 ? numThreads : std::max(1, (int)std::thread::hardware_concurrency());
+#if !USE_MULTITHREAD
+		numWorkers = 1;
+#endif
+		for (int i = 0; i < numWorkers; i++) {
+			AlgorithmObjects *algo = new AlgorithmObjects();
+			algo->arena = new Arena();
+			workers.push_back(new std::thread(&FrechetIndex::worker, this, algo));
+		}
+	}
+
+	~FrechetIndex() {
+		{
+			std::lock_guard<std::mutex> lock(mtx);
+			stop = true;
+		}
+		queued.notify_all();
+		for (std::thread *t : workers) {
+			t->join();
+			delete t;
+		}
+		release();
+	}
+
+	FrechetIndex(const FrechetIndex&) = delete;
+	FrechetIndex& operator=(const FrechetIndex&) = delete;
+
+	// Preprocesses the trajectories, results refer to them by their index in trajectories. Names are
+	// optional, they are only kept for name(). Trajectories with less than 2 distinct vertices are
+	// never a result. Replaces the trajectories of an earlier build.
+	void build(const std::vector<std::vector<Vertex>> &trajectories, const std::vector<std::string> &names = std::vector<std::string>()) {
+		release();
+		AlgoData *data = new AlgoData();
+		data->numWorkers = numWorkers;
+		data->queries = new std::vector<Query>();
+		data->boundingBox = new BoundingBox();
+		data->numTrajectories = trajectories.size();
+		data->trajectoryNames = new std::vector<std::string>(trajectories.size());
+		for (int i = 0; i < trajectories.size(); i++) {
+			data->trajectoryNames->at(i) = i < names.size() ? names[i] : std::to_string(i);
+		}
+		data->datasetPoints = &trajectories;
+		preprocessDataSet(data);
+		data->datasetPoints = nullptr;
+		// the candidates of a query are split into chunks, which idle pool workers help deciding
+		data->scheduler.onShared = [this]() -> void {
+			std::lock_guard<std::mutex> lock(mtx);
+			queued.notify_all();
+		};
+		std::lock_guard<std::mutex> lock(mtx);
+		a = data;
+	}
+
+	int size() {
+		return a == nullptr ? 0 : a->numTrajectories;
+	}
+
+	const std::string& name(int i) {
+		return a->trajectoryNames->at(i);
+	}
+
+	// Indices of all trajectories within frechet distance delta of the query trajectory, ascending.
+	// Empty for a query trajectory with less than 2 distinct vertices.
+	std::vector<int> rangeQuery(const std::vector<Vertex> &points, double delta) {
+		std::vector<int> result;
+		run(1, [&](int, AlgorithmObjects *algo) -> void {
+			solve(points, delta, 0, algo, &result, nullptr);
+		});
+		return result;
+	}
+
+	// The k trajectories closest to the query trajectory, closest first.
+	// Empty for k <= 0, and for a query trajectory with less than 2 distinct vertices.
+	std::vector<Neighbour> knnQuery(const std::vector<Vertex> &points, int k) {
+		std::vector<Neighbour> result;
+		if (k <= 0) return result;
+		run(1, [&](int, AlgorithmObjects *algo) -> void {
+			solve(points, 0, k, algo, nullptr, &result);
+		});
+		return result;
+	}
+
+	// Range queries solved concurrently by the thread pool, results[i] are those of rangeQuery(queries[i], deltas[i])
+	std::vector<std::vector<int>> batchQuery(const std::vector<std::vector<Vertex>> &queries, const std::vector<double> &deltas) {
+		std::vector<std::vector<int>> results(queries.size());
+		run(std::min(queries.size(), deltas.size()), [&](int i, AlgorithmObjects *algo) -> void {
+			solve(queries[i], deltas[i], 0, algo, &results[i], nullptr);
+		});
+		return results;
+	}
+
+private:
+	// A number of tasks handed out to the pool one at a time
+	struct Batch {
+		std::function<void(int, AlgorithmObjects*)> task;
+		int size = 0;
+		int next = 0;
+		int done = 0;
+		std::condition_variable finished;
+	};
+
+	AlgoData *a = nullptr;
+	int numWorkers;
+	std::vector<std::thread*> workers;
+	std::deque<Batch*> batches;
+	std::mutex mtx;
+	std::condition_variable queued;
+	bool stop = false;
+
+	// Runs tasks of the batches, and helps with the candidates of queries being solved by other workers
+	void worker(AlgorithmObjects *algo) {
+		std::unique_lock<std::mutex> lock(mtx);
+		while (true) {
+			queued.wait(lock, [&]() -> bool { return stop || !batches.empty() || sharedWork(); });
+			if (sharedWork()) {
+				AlgoData *data = a;
+				lock.unlock();
+				data->scheduler.tryHelp(algo);
+				lock.lock();
+				continue;
+			}
+			if (batches.empty()) break;
+			Batch *b = batches.front();
+			int i = b->next++;
+			if (b->next == b->size) {
+				batches.pop_front();
+			}
+			lock.unlock();
+			b->task(i, algo);
+			lock.lock();
+			if (++b->done == b->size) {
+				b->finished.notify_all();
+			}
+		}
+		delete algo->arena;
+		delete algo;
+	}
+
+	// true if a query being solved has candidates left to decide, needs mtx
+	bool sharedWork() {
+		return a != nullptr && a->scheduler.hasSharedWork();
+	}
+
+	// Runs task(0) to task(size - 1) on the pool and waits for them
+	void run(int size, const std::function<void(int, AlgorithmObjects*)> &task) {
+		if (size <= 0 || a == nullptr) return;
+		Batch b;
+		b.task = task;
+		b.size = size;
+		std::unique_lock<std::mutex> lock(mtx);
+		batches.push_back(&b);
+		queued.notify_all();
+		b.finished.wait(lock, [&]() -> bool { return b.done == b.size; });
+	}
+
+	// Solves a range query (k == 0) or a k nearest neighbour query on a worker
+	void solve(const std::vector<Vertex> &points, double delta, int k, AlgorithmObjects *algo, std::vector<int> *range, std::vector<Neighbour> *nearest) {
+		Trajectory *queryTrajectory = algo->fio.makeTrajectory(points, "query", -1, algo->queryArena);
+		if (queryTrajectory->size >= 2) {
+			makeQuerySimplifications(*a, *queryTrajectory, *algo, algo->queryArena);
+			Query query;
+			query.queryTrajectoryFilename = "query";
+			query.queryDelta = delta;
+			query.queryNumber = -1;
+			query.knn = k;
+			QueryGroup group;
+			group.queryTrajectoryFilename = query.queryTrajectoryFilename;
+			group.queries.push_back(&query);
+			std::vector<std::vector<Trajectory*>> results;
+			solveGroupOn(a, group, algo, queryTrajectory, results);
+			if (range != nullptr) {
+				for (Trajectory *t : results[0]) {
+					range->push_back(t->uniqueIDInDataset);
+				}
+				std::sort(range->begin(), range->end());
+			}
+			if (nearest != nullptr) {
+				for (std::pair<double, Trajectory*> &n : algo->nearest) {
+					nearest->push_back(Neighbour(n.second->uniqueIDInDataset, n.first));
+				}
+			}
+		}
+		deleteQueryTrajectory(queryTrajectory);
+		algo->queryArena.reset();
+	}
+
+	void release() {
+		AlgoData *data;
+		{
+			std::lock_guard<std::mutex> lock(mtx);
+			data = a;
+			a = nullptr;
+		}
+		if (data == nullptr) return;
+		cleanup(data);
+		delete data->queries;
+		delete data->trajectoryNames;
+		delete data->boundingBox;
+		delete data;
+	}
+};
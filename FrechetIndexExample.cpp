@@ -0,0 +1,64 @@
+// Example of embedding FrechetIndex: solves a queryset against a dataset like the main program,
+// but with all trajectories read into memory first. Results are written to results.txt in the
+// same "query <number> <count>" blocks. Built from this file and FrechetIndexExampleLoad.cpp.
+#include "FrechetIndex.h"
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <iostream>
+
+std::vector<Vertex> loadTrajectory(FileIO &fio, const std::string &filename);
+std::vector<std::vector<Vertex>> loadDataset(const std::string &filename, std::vector<std::string> &names);
+
+int main(int argc, char *argv[])
+{
+	if (argc < 3) {
+		std::cout << "Usage: " << argv[0] << " dataset.txt queryset.txt [threads]\n";
+		return 1;
+	}
+	std::vector<std::string> names;
+	std::vector<std::vector<Vertex>> trajectories = loadDataset(argv[1], names);
+	FrechetIndex index(argc > 3 ? atoi(argv[3]) : 0);
+	index.build(trajectories, names);
+
+	// range queries are solved together, k nearest neighbour queries one at a time
+	FileIO fio;
+	std::vector<Query> *queries = fio.parseQueryFile(argv[2]);
+	std::vector<std::vector<Vertex>> rangePoints;
+	std::vector<double> deltas;
+	for (Query &q : *queries) {
+		if (q.knn == 0) {
+			rangePoints.push_back(loadTrajectory(fio, q.queryTrajectoryFilename));
+			deltas.push_back(q.queryDelta);
+		}
+	}
+	std::vector<std::vector<int>> ranges = index.batchQuery(rangePoints, deltas);
+
+	FILE *out = fopen("results.txt", "wb");
+	if (out == NULL) {
+		std::cout << "Failed to open: results.txt\n";
+		return 1;
+	}
+	int range = 0;
+	for (Query &q : *queries) {
+		if (q.knn == 0) {
+			std::vector<int> &result = ranges[range++];
+			fprintf(out, "query %05d %zu\n", q.queryNumber, result.size());
+			for (int i : result) {
+				fprintf(out, "%s\n", index.name(i).c_str());
+			}
+		}
+		else {
+			std::vector<FrechetIndex::Neighbour> nearest = index.knnQuery(loadTrajectory(fio, q.queryTrajectoryFilename), q.knn);
+			fprintf(out, "query %05d %zu\n", q.queryNumber, nearest.size());
+			for (FrechetIndex::Neighbour &n : nearest) {
+				fprintf(out, "%s %.15g\n", index.name(n.first).c_str(), n.second);
+			}
+		}
+	}
+	fclose(out);
+	std::cout << "Solved " << queries->size() << " queries on " << index.size() << " trajectories\n";
+	delete queries;
+	return 0;
+}
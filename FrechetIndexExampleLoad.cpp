@@ -0,0 +1,28 @@
+// Loading part of the FrechetIndex example (see FrechetIndexExample.cpp). It is a translation unit
+// of its own, so the example also checks that FrechetIndex.h can be included from several source files.
+#include "FrechetIndex.h"
+
+#include <string>
+#include <vector>
+
+// Reads the vertices of a trajectory file, without duplicate vertices
+std::vector<Vertex> loadTrajectory(FileIO &fio, const std::string &filename) {
+	Arena arena;
+	Trajectory *t = fio.parseTrajectoryFile(filename, -1, arena);
+	std::vector<Vertex> points(t->vertices.data(), t->vertices.data() + t->size);
+	delete t;
+	return points;
+}
+
+// Reads every trajectory listed in a dataset file into memory, names are the file names
+std::vector<std::vector<Vertex>> loadDataset(const std::string &filename, std::vector<std::string> &names) {
+	FileIO fio;
+	std::vector<std::string> *listed = fio.parseDatasetFile(filename);
+	names = *listed;
+	delete listed;
+	std::vector<std::vector<Vertex>> trajectories;
+	for (std::string &name : names) {
+		trajectories.push_back(loadTrajectory(fio, name));
+	}
+	return trajectories;
+}
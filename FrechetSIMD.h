@@ -0,0 +1,209 @@
+// Batched version of computeInterval (FrechetUtil.h) for free-space column sweeps.
+// For one column (query segment qa-qb) it computes the right and top edge intervals
+// of a run of consecutive rows at once. An AVX2 kernel is picked at runtime when the
+// cpu supports it, otherwise the scalar kernel is used. Both give the same results as
+// computeInterval, bit for bit.
+#pragma once
+
+#include "Vertex.h"
+#include "FrechetUtil.h"
+#include "settings.h"
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define FRECHET_HAS_AVX2_KERNEL 1
+#include <immintrin.h>
+#else
+#define FRECHET_HAS_AVX2_KERNEL 0
+#endif
+
+// maximum number of rows computed in one batch
+#define INTERVAL_BATCH_SIZE 8
+
+// Free intervals of a run of rows in one column, row (first + i) is at index i
+struct IntervalBatch {
+	double rightStart[INTERVAL_BATCH_SIZE];
+	double rightEnd[INTERVAL_BATCH_SIZE];
+	bool rightFree[INTERVAL_BATCH_SIZE];
+	double topStart[INTERVAL_BATCH_SIZE];
+	double topEnd[INTERVAL_BATCH_SIZE];
+	bool topFree[INTERVAL_BATCH_SIZE];
+};
+
+// Scalar kernel: right edges are computeInterval(qb, P[r], P[r + 1]), top edges computeInterval(P[r + 1], qa, qb),
+// with the segment geometry read from Psegs and qseg
+inline void computeIntervalBatchScalar(Vertex *P, Segment *Psegs, int first, int count, Vertex &qa, Vertex &qb, Segment &qseg, double eps, IntervalBatch &b) {
+	Range r = { 0, 0 };
+	for (int i = 0; i < count; i++) {
+		int row = first + i;
+		b.rightFree[i] = computeInterval(qb, P[row], Psegs[row], eps, r);
+		b.rightStart[i] = r.start;
+		b.rightEnd[i] = r.end;
+		b.topFree[i] = computeInterval(P[row + 1], qa, qseg, eps, r);
+		b.topStart[i] = r.start;
+		b.topEnd[i] = r.end;
+	}
+}
+
+#if FRECHET_HAS_AVX2_KERNEL
+// Solves four instances of the quadratic in computeInterval, in the same operation order
+// so the results match the scalar code exactly. No FMA is used for the same reason.
+__attribute__((target("avx2")))
+inline void solveIntervals4(__m256d b2m1x, __m256d b2m1y, __m256d A, __m256d b1max, __m256d b1may, __m256d epsSQ,
+	double *start, double *end, bool *isFree) {
+	const __m256d zero = _mm256_setzero_pd();
+	const __m256d one = _mm256_set1_pd(1.0);
+	const __m256d two = _mm256_set1_pd(2.0);
+	const __m256d four = _mm256_set1_pd(4.0);
+
+	__m256d B = _mm256_mul_pd(two, _mm256_add_pd(_mm256_mul_pd(b2m1x, b1max), _mm256_mul_pd(b2m1y, b1may)));
+	__m256d C = _mm256_sub_pd(_mm256_add_pd(_mm256_mul_pd(b1max, b1max), _mm256_mul_pd(b1may, b1may)), epsSQ);
+	__m256d D = _mm256_sub_pd(_mm256_mul_pd(B, B), _mm256_mul_pd(_mm256_mul_pd(four, A), C));
+
+	__m256d sqrtD = _mm256_sqrt_pd(D);
+	__m256d twoA = _mm256_mul_pd(two, A);
+	__m256d negB = _mm256_xor_pd(B, _mm256_set1_pd(-0.0));
+	__m256d t1 = _mm256_div_pd(_mm256_add_pd(negB, sqrtD), twoA);
+	__m256d t2 = _mm256_div_pd(_mm256_sub_pd(negB, sqrtD), twoA);
+	// operand order mirrors std::min / std::max for NaN inputs
+	__m256d lo = _mm256_min_pd(t2, t1);
+	__m256d hi = _mm256_max_pd(t2, t1);
+
+	__m256d empty = _mm256_or_pd(_mm256_cmp_pd(D, zero, _CMP_LT_OQ),
+		_mm256_or_pd(_mm256_cmp_pd(hi, zero, _CMP_LT_OQ), _mm256_cmp_pd(lo, one, _CMP_GT_OQ)));
+	int emptyMask = _mm256_movemask_pd(empty);
+
+	_mm256_storeu_pd(start, _mm256_max_pd(lo, zero));
+	_mm256_storeu_pd(end, _mm256_min_pd(hi, one));
+	for (int i = 0; i < 4; i++) {
+		isFree[i] = ((emptyMask >> i) & 1) == 0;
+	}
+}
+
+__attribute__((target("avx2")))
+inline void computeIntervalBatchAVX2(Vertex *P, Segment *Psegs, int first, int count, Vertex &qa, Vertex &qb, Segment &qseg, double eps, IntervalBatch &b) {
+	int i = 0;
+	__m256d epsSQ = _mm256_set1_pd(eps * eps);
+	__m256d qax = _mm256_set1_pd(qa.x);
+	__m256d qay = _mm256_set1_pd(qa.y);
+	__m256d qbx = _mm256_set1_pd(qb.x);
+	__m256d qby = _mm256_set1_pd(qb.y);
+	__m256d qdx = _mm256_set1_pd(qseg.dx);
+	__m256d qdy = _mm256_set1_pd(qseg.dy);
+	__m256d qA = _mm256_set1_pd(qseg.lengthSQ);
+	for (; i + 4 <= count; i += 4) {
+		Vertex *p = P + first + i;
+		Segment *s = Psegs + first + i;
+		__m256d px0 = _mm256_set_pd(p[3].x, p[2].x, p[1].x, p[0].x);
+		__m256d py0 = _mm256_set_pd(p[3].y, p[2].y, p[1].y, p[0].y);
+		__m256d px1 = _mm256_set_pd(p[4].x, p[3].x, p[2].x, p[1].x);
+		__m256d py1 = _mm256_set_pd(p[4].y, p[3].y, p[2].y, p[1].y);
+		__m256d sdx = _mm256_set_pd(s[3].dx, s[2].dx, s[1].dx, s[0].dx);
+		__m256d sdy = _mm256_set_pd(s[3].dy, s[2].dy, s[1].dy, s[0].dy);
+		__m256d sA = _mm256_set_pd(s[3].lengthSQ, s[2].lengthSQ, s[1].lengthSQ, s[0].lengthSQ);
+
+		// right edge: point qb against segment P[r] - P[r + 1]
+		solveIntervals4(sdx, sdy, sA,
+			_mm256_sub_pd(px0, qbx), _mm256_sub_pd(py0, qby), epsSQ,
+			&b.rightStart[i], &b.rightEnd[i], &b.rightFree[i]);
+		// top edge: point P[r + 1] against segment qa - qb
+		solveIntervals4(qdx, qdy, qA,
+			_mm256_sub_pd(qax, px1), _mm256_sub_pd(qay, py1), epsSQ,
+			&b.topStart[i], &b.topEnd[i], &b.topFree[i]);
+	}
+	if (i < count) {
+		// tail of the run
+		IntervalBatch tail;
+		computeIntervalBatchScalar(P, Psegs, first + i, count - i, qa, qb, qseg, eps, tail);
+		for (int j = 0; i + j < count; j++) {
+			b.rightStart[i + j] = tail.rightStart[j];
+			b.rightEnd[i + j] = tail.rightEnd[j];
+			b.rightFree[i + j] = tail.rightFree[j];
+			b.topStart[i + j] = tail.topStart[j];
+			b.topEnd[i + j] = tail.topEnd[j];
+			b.topFree[i + j] = tail.topFree[j];
+		}
+	}
+}
+#endif
+
+// true if the AVX2 kernel can be used on this cpu, detected once
+inline bool useAVX2Intervals() {
+#if FRECHET_HAS_AVX2_KERNEL
+	static const bool supported = __builtin_cpu_supports("avx2");
+	return supported;
+#else
+	return false;
+#endif
+}
+
+// Column sweep helper used by the freespace algorithms. Serves the right and top
+// intervals of rows in the current column from a batch, and computes the next
+// batch of up to INTERVAL_BATCH_SIZE rows when a row outside the batch is requested.
+class ColumnIntervals {
+	Vertex *P;
+	Segment *Psegs;
+	int lastRow; // last row of the diagram, rows go up to P[lastRow + 1]
+	Vertex *qa;
+	Vertex *qb;
+	Segment *qseg;
+	double eps;
+	bool avx2;
+
+	int first = 0;
+	int count = 0;
+	IntervalBatch batch;
+
+	inline int slot(int row) {
+		if (row < first || row >= first + count) {
+			first = row;
+			count = std::min(INTERVAL_BATCH_SIZE, lastRow - row + 1);
+#if FRECHET_HAS_AVX2_KERNEL
+			if (avx2) {
+				computeIntervalBatchAVX2(P, Psegs, first, count, *qa, *qb, *qseg, eps, batch);
+				return 0;
+			}
+#endif
+			computeIntervalBatchScalar(P, Psegs, first, count, *qa, *qb, *qseg, eps, batch);
+		}
+		return row - first;
+	}
+
+public:
+	ColumnIntervals() {
+		avx2 = useAVX2Intervals();
+	}
+
+	// start sweeping the column of query segment a - b (with geometry seg), with sizeP vertices in P
+	void startColumn(Vertex *p, Segment *psegs, int sizeP, Vertex &a, Vertex &b, Segment &seg, double epsilon) {
+		P = p;
+		Psegs = psegs;
+		lastRow = sizeP - 2;
+		qa = &a;
+		qb = &b;
+		qseg = &seg;
+		eps = epsilon;
+		count = 0;
+	}
+
+	// same as computeInterval(qb, P[row], P[row + 1], eps, r)
+	inline bool right(int row, Range &r) {
+		int i = slot(row);
+		// like computeInterval, r is left untouched when the edge is not free
+		if (!batch.rightFree[i]) return false;
+		r.start = batch.rightStart[i];
+		r.end = batch.rightEnd[i];
+		return true;
+	}
+
+	// same as computeInterval(P[row + 1], qa, qb, eps, r)
+	inline bool top(int row, Range &r) {
+		int i = slot(row);
+		if (!batch.topFree[i]) return false;
+		r.start = batch.topStart[i];
+		r.end = batch.topEnd[i];
+		return true;
+	}
+};
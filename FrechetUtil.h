@@ -10,34 +10,34 @@ struct Range {
 	double end;
 };
 
-Range emptyRange = { 0,0 };
-Range dontCare = { 0, 0 };
+const Range emptyRange = { 0,0 };
+const Range dontCare = { 0, 0 };
 
-bool isEmpty(Range &r) {
+inline bool isEmpty(Range &r) {
 	return r.start == r.end;
 }
 
-bool isComplete(Range &r) {
+inline bool isComplete(Range &r) {
 	return r.start == 0.0 && r.end == 1.0;
 }
 
-void setRange(Range &r, Range &s) {
+inline void setRange(Range &r, Range &s) {
 	r.start = s.start;
 	r.end = s.end;
 }
 
-void setRange(Range &r, double start, double end) {
+inline void setRange(Range &r, double start, double end) {
 	r.start = start;
 	r.end = end;
 }
 
-double distSQ(Vertex &p, Vertex &q) {
+inline double distSQ(Vertex &p, Vertex &q) {
 	double dx = p.x - q.x;
 	double dy = p.y - q.y;
 	return dx*dx + dy*dy;
 }
 
-double clamp01(double input) {
+inline double clamp01(double input) {
 	return input > 1 ? 1 : (input < 0 ? 0 : input);
 }
 
@@ -93,5 +93,70 @@ inline bool computeInterval(Vertex &a, Vertex &b1, Vertex &b2, double eps, Range
 	}
 };
 
+// Same as computeInterval(a, b1, b2, eps, r), with the segment b1-b2 taken from the precomputed table
+inline bool computeInterval(Vertex &a, Vertex &b1, Segment &b, double eps, Range &r) {
+	double b1max = b1.x - a.x;
+	double b1may = b1.y - a.y;
+
+	double A = b.lengthSQ;
+	double B = 2 * ((b.dx) * (b1max) + (b.dy) * (b1may));
+	double C = b1max*b1max + b1may * b1may - eps*eps;
+
+	double D = B * B - 4 * A * C;
+	if (D < 0) {
+		// no solution
+		return false;
+	}
+	else {
+		double sqrtD = sqrt(D);
+		double t1 = (-B + sqrtD) / (2 * A);
+		double t2 = (-B - sqrtD) / (2 * A);
+		double tempt1 = t1;
+		t1 = std::min(t1, t2);
+		t2 = std::max(tempt1, t2);
+
+		if (t2 < 0 || t1 > 1) {
+			return false;
+		}
+		else {
+			r.start = std::max(0.0, t1);
+			r.end = std::min(1.0, t2);
+			return true;
+		}
+	}
+}
 
+// computeInterval for two epsilons at once, sharing the parts that do not depend on epsilon.
+// Gives the same intervals as two computeInterval calls. Returns whether the edge is free for epsHigh,
+// freeLow is set for epsLow. Ranges are left untouched when the edge is not free.
+inline bool computeIntervalPair(Vertex &a, Vertex &b1, Segment &b, double epsLow, double epsHigh, Range &low, Range &high, bool &freeLow) {
+	double b1max = b1.x - a.x;
+	double b1may = b1.y - a.y;
 
+	double A = b.lengthSQ;
+	double B = 2 * ((b.dx) * (b1max) + (b.dy) * (b1may));
+	double distSQ = b1max*b1max + b1may * b1may;
+	double BB = B * B;
+	double twoA = 2 * A;
+
+	bool free[2] = { false, false };
+	double eps[2] = { epsLow, epsHigh };
+	Range *r[2] = { &low, &high };
+	for (int i = 0; i < 2; i++) {
+		double C = distSQ - eps[i] * eps[i];
+		double D = BB - 4 * A * C;
+		if (D < 0) continue;
+		double sqrtD = sqrt(D);
+		double t1 = (-B + sqrtD) / twoA;
+		double t2 = (-B - sqrtD) / twoA;
+		double tempt1 = t1;
+		t1 = std::min(t1, t2);
+		t2 = std::max(tempt1, t2);
+		if (t2 < 0 || t1 > 1) continue;
+		r[i]->start = std::max(0.0, t1);
+		r[i]->end = std::min(1.0, t2);
+		free[i] = true;
+	}
+	freeLow = free[0];
+	return free[1];
+}
@@ -0,0 +1,430 @@
+// Saves and loads the complete preprocessed state of a dataset: trajectories, their
+// simplifications and portals, the learned simplification ratios, the bounding box
+// and the endpoint index. The file is memory mapped on load, and trajectory arrays
+// point directly into the mapping, so a restart does not parse or simplify anything.
+//
+// Layout: SnapshotHeader, then one SnapshotTrajectory record per dataset trajectory
+// (each followed by its simplification records and its name in the dataset file), then the endpoint index.
+// Every block starts at a multiple of 16 bytes.
+#pragma once
+
+#include "Trajectory.h"
+#include "DiHash.h"
+#include "EndpointIndex.h"
+#include "settings.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <cstring>
+#include <iostream>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#define SNAPSHOT_MAGIC "FRCHIDX"
+#define SNAPSHOT_VERSION 3
+
+struct SnapshotHeader {
+	char magic[8];
+	int32_t version;
+	// layout checks, a snapshot only loads in a build with the same struct sizes
+	int32_t vertexSize;
+	int32_t segmentSize;
+	int32_t portalSize;
+	int32_t numSimplifications;
+	int32_t indexType; // 0 -> DiHash, 1 -> EndpointIndex
+	int32_t numTrajectories;
+	int32_t learnedCount;
+	double avgsBBRatio[4];
+	double boundingBox[4];
+};
+
+struct SnapshotTrajectory {
+	int32_t size; // 0 -> no trajectory at this index
+	int32_t uniqueIDInDataset;
+	int32_t nameLength;
+	int32_t numSimplifications;
+	int32_t sourceIndexLength;
+	int32_t numPortals;
+	double totalLength;
+	double simplificationEpsilon;
+	double boundingBox[4];
+};
+
+struct SnapshotSubGrid {
+	int32_t slots;
+	int32_t numOffsets;
+	double minx;
+	double miny;
+	double pasx;
+	double pasy;
+};
+
+// Read-only view of a whole file in memory, mapped where possible
+class MappedFile {
+public:
+	char *data = nullptr;
+	size_t size = 0;
+	bool mapped = false;
+
+	bool open(std::string filename) {
+#ifndef _WIN32
+		int fd = ::open(filename.c_str(), O_RDONLY);
+		if (fd < 0) return false;
+		struct stat st;
+		if (fstat(fd, &st) != 0) {
+			::close(fd);
+			return false;
+		}
+		size = st.st_size;
+		// private mapping: pages are shared with the page cache until written
+		void *m = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+		::close(fd);
+		if (m == MAP_FAILED) return false;
+		data = (char*)m;
+		mapped = true;
+		return true;
+#else
+		FILE *file = fopen(filename.c_str(), "rb");
+		if (file == NULL) return false;
+		fseek(file, 0, SEEK_END);
+		size = ftell(file);
+		fseek(file, 0, SEEK_SET);
+		data = (char*)malloc(size);
+		bool ok = fread(data, 1, size, file) == size;
+		fclose(file);
+		return ok;
+#endif
+	}
+
+	~MappedFile() {
+		if (data == nullptr) return;
+#ifndef _WIN32
+		if (mapped) {
+			munmap(data, size);
+			return;
+		}
+#endif
+		free(data);
+	}
+};
+
+class SnapshotWriter {
+	FILE *file;
+	size_t pos = 0;
+
+public:
+	SnapshotWriter(std::string filename) {
+		file = fopen(filename.c_str(), "wb");
+		if (file == NULL) {
+			std::cout << "Failed to open: " << filename << "\n";
+			exit(1);
+		}
+	}
+
+	~SnapshotWriter() {
+		fclose(file);
+	}
+
+	// writes a block, padded to a multiple of 16 bytes
+	void put(const void *data, size_t bytes) {
+		static const char zeros[16] = { 0 };
+		if (bytes > 0) fwrite(data, 1, bytes, file);
+		pos += bytes;
+		size_t padding = (16 - pos % 16) % 16;
+		fwrite(zeros, 1, padding, file);
+		pos += padding;
+	}
+
+	template<typename T>
+	void put(ArenaArray<T> &a) {
+		put(a.data(), a.size() * sizeof(T));
+	}
+
+	template<typename T>
+	void put(std::vector<T> &v) {
+		int64_t n = v.size();
+		put(&n, sizeof(n));
+		put(v.data(), v.size() * sizeof(T));
+	}
+};
+
+class SnapshotReader {
+	char *base;
+	size_t size;
+	size_t pos = 0;
+
+public:
+	SnapshotReader(char *data, size_t iSize) {
+		base = data;
+		size = iSize;
+	}
+
+	// returns the next block of n items of T, the counterpart of SnapshotWriter::put.
+	// n comes from the file, so it is checked against the bytes left before computing the size
+	template<typename T>
+	T* take(int64_t n) {
+		if (n < 0 || (uint64_t)n > (size - pos) / sizeof(T)) {
+			std::cout << "Index snapshot is truncated or corrupt\n";
+			exit(1);
+		}
+		size_t bytes = n * sizeof(T);
+		T *result = (T*)(base + pos);
+		pos += bytes;
+		pos = std::min(size, pos + (16 - pos % 16) % 16);
+		return result;
+	}
+
+	template<typename T>
+	void take(ArenaArray<T> &a, int n) {
+		a.view(n != 0 ? take<T>(n) : nullptr, n);
+	}
+
+	template<typename T>
+	void take(std::vector<T> &v) {
+		int64_t n = *take<int64_t>(1);
+		T *items = take<T>(n);
+		v.assign(items, items + n);
+	}
+};
+
+inline void writeSnapshotTrajectory(SnapshotWriter &w, Trajectory *t, double simplificationEpsilon) {
+	SnapshotTrajectory r;
+	memset(&r, 0, sizeof(r));
+	if (t == nullptr) {
+		w.put(&r, sizeof(r));
+		return;
+	}
+	r.size = t->size;
+	r.uniqueIDInDataset = t->uniqueIDInDataset;
+	r.nameLength = t->name.size();
+	r.numSimplifications = t->simplifications.size();
+	r.sourceIndexLength = t->sourceIndex.size();
+	r.numPortals = t->simpPortals.portals.size();
+	r.totalLength = t->totalLength;
+	r.simplificationEpsilon = simplificationEpsilon;
+	r.boundingBox[0] = t->boundingBox.minx;
+	r.boundingBox[1] = t->boundingBox.miny;
+	r.boundingBox[2] = t->boundingBox.maxx;
+	r.boundingBox[3] = t->boundingBox.maxy;
+	w.put(&r, sizeof(r));
+	w.put(t->name.data(), t->name.size());
+	w.put(t->vertices);
+	w.put(t->distances);
+	w.put(t->totals);
+	w.put(t->sourceIndex);
+	w.put(t->segments);
+	if (r.numPortals > 0) {
+		w.put(t->simpPortals.offsets);
+		w.put(t->simpPortals.portals);
+	}
+	for (TrajectorySimplification *s : t->simplifications) {
+		writeSnapshotTrajectory(w, s, s->simplificationEpsilon);
+	}
+}
+
+// Reads one trajectory record, the arrays of t point into the snapshot
+inline void readSnapshotTrajectory(SnapshotReader &r, SnapshotTrajectory &rec, Trajectory *t) {
+	t->size = rec.size;
+	t->uniqueIDInDataset = rec.uniqueIDInDataset;
+	t->totalLength = rec.totalLength;
+	t->boundingBox.minx = rec.boundingBox[0];
+	t->boundingBox.miny = rec.boundingBox[1];
+	t->boundingBox.maxx = rec.boundingBox[2];
+	t->boundingBox.maxy = rec.boundingBox[3];
+	char *name = r.take<char>(rec.nameLength);
+	t->name.assign(name, rec.nameLength);
+	r.take(t->vertices, rec.size);
+	r.take(t->distances, rec.size);
+	r.take(t->totals, rec.size);
+	r.take(t->sourceIndex, rec.sourceIndexLength);
+	r.take(t->segments, rec.size > 0 ? rec.size - 1 : 0);
+	if (rec.numPortals > 0) {
+		r.take(t->simpPortals.offsets, rec.size + 1);
+		r.take(t->simpPortals.portals, rec.numPortals);
+	}
+	for (int i = 0; i < rec.numSimplifications; i++) {
+		SnapshotTrajectory simpRec = *r.take<SnapshotTrajectory>(1);
+		TrajectorySimplification *s = new TrajectorySimplification();
+		s->source = t;
+		s->simplificationEpsilon = simpRec.simplificationEpsilon;
+		readSnapshotTrajectory(r, simpRec, s);
+		t->simplifications.push_back(s);
+	}
+}
+
+inline void writeSnapshotDiHash(SnapshotWriter &w, DiHash &d) {
+	int32_t ints[3] = { d.slotsPerDimension, d.maxCellPoints, d.maxSubSlots };
+	w.put(ints, sizeof(ints));
+	w.put(d.limits, sizeof(d.limits));
+	w.put(&d.tol, sizeof(d.tol));
+	DiHash::Grid &grid = d.grid;
+	w.put(grid.offsets);
+	w.put(grid.xs);
+	w.put(grid.ys);
+	w.put(grid.exs);
+	w.put(grid.eys);
+	w.put(grid.ids);
+	w.put(grid.subGridOf);
+	int64_t numSubGrids = grid.subGrids.size();
+	w.put(&numSubGrids, sizeof(numSubGrids));
+	for (DiHash::SubGrid &sub : grid.subGrids) {
+		SnapshotSubGrid s = { sub.slots, (int32_t)sub.offsets.size(), sub.minx, sub.miny, sub.pasx, sub.pasy };
+		w.put(&s, sizeof(s));
+		w.put(sub.offsets.data(), sub.offsets.size() * sizeof(int));
+	}
+}
+
+inline DiHash* readSnapshotDiHash(SnapshotReader &r, BoundingBox &boundingBox) {
+	int32_t *ints = r.take<int32_t>(3);
+	DiHash *d = new DiHash(boundingBox, ints[0], 0);
+	d->maxCellPoints = ints[1];
+	d->maxSubSlots = ints[2];
+	memcpy(d->limits, r.take<double>(4), sizeof(d->limits));
+	d->tol = *r.take<double>(1);
+	DiHash::Grid &grid = d->grid;
+	r.take(grid.offsets);
+	r.take(grid.xs);
+	r.take(grid.ys);
+	r.take(grid.exs);
+	r.take(grid.eys);
+	r.take(grid.ids);
+	r.take(grid.subGridOf);
+	int64_t numSubGrids = *r.take<int64_t>(1);
+	for (int64_t i = 0; i < numSubGrids; i++) {
+		SnapshotSubGrid s = *r.take<SnapshotSubGrid>(1);
+		DiHash::SubGrid sub;
+		sub.slots = s.slots;
+		sub.minx = s.minx;
+		sub.miny = s.miny;
+		sub.pasx = s.pasx;
+		sub.pasy = s.pasy;
+		int *offsets = r.take<int>(s.numOffsets);
+		sub.offsets.assign(offsets, offsets + s.numOffsets);
+		grid.subGrids.push_back(sub);
+	}
+	return d;
+}
+
+// Writes the preprocessed state of (a) to filename
+inline void saveIndexSnapshot(AlgoData &a, std::string filename) {
+	SnapshotWriter w(filename);
+	SnapshotHeader h;
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+	h.version = SNAPSHOT_VERSION;
+	h.vertexSize = sizeof(Vertex);
+	h.segmentSize = sizeof(Segment);
+	h.portalSize = sizeof(Portal);
+	h.numSimplifications = numSimplifications;
+	h.indexType = a.endpointIndex != nullptr ? 1 : 0;
+	h.numTrajectories = a.trajectories->size();
+	h.learnedCount = a.learnedCount;
+	for (int i = 0; i < 4; i++) {
+		h.avgsBBRatio[i] = a.avgsBBRatio[i];
+	}
+	h.boundingBox[0] = a.boundingBox->minx;
+	h.boundingBox[1] = a.boundingBox->miny;
+	h.boundingBox[2] = a.boundingBox->maxx;
+	h.boundingBox[3] = a.boundingBox->maxy;
+	w.put(&h, sizeof(h));
+
+	for (int i = 0; i < a.trajectories->size(); i++) {
+		writeSnapshotTrajectory(w, a.trajectories->at(i), 0);
+		// the name as listed in the dataset file (trajectory names include TRAJECTORY_FILES_OFFSET),
+		// so loading can check the snapshot matches the dataset file
+		std::string &name = a.trajectoryNames->at(i);
+		int32_t nameLength = name.size();
+		w.put(&nameLength, sizeof(nameLength));
+		w.put(name.data(), name.size());
+	}
+
+	if (a.endpointIndex != nullptr) {
+		w.put(a.endpointIndex->entries);
+	}
+	else {
+		writeSnapshotDiHash(w, *a.diHash);
+	}
+	std::cout << "Saved index snapshot: " << filename << "\n";
+}
+
+// Replaces preprocessing: maps filename and points all trajectory data of (a) into it
+inline void loadIndexSnapshot(AlgoData &a, std::string filename) {
+	MappedFile *file = new MappedFile();
+	if (!file->open(filename)) {
+		std::cout << "Failed to open: " << filename << "\n";
+		exit(1);
+	}
+	SnapshotReader r(file->data, file->size);
+	SnapshotHeader h = *r.take<SnapshotHeader>(1);
+	if (memcmp(h.magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)) != 0 || h.version != SNAPSHOT_VERSION) {
+		std::cout << "Not an index snapshot, or made by another version: " << filename << "\n";
+		exit(1);
+	}
+	if (h.vertexSize != sizeof(Vertex) || h.segmentSize != sizeof(Segment) || h.portalSize != sizeof(Portal)
+		|| h.numSimplifications != numSimplifications || h.indexType != (USE_ENDPOINT_INDEX ? 1 : 0)) {
+		std::cout << "Index snapshot was made with different settings: " << filename << "\n";
+		exit(1);
+	}
+	a.learnedCount = h.learnedCount;
+	for (int i = 0; i < 4; i++) {
+		a.avgsBBRatio[i] = h.avgsBBRatio[i];
+	}
+	a.boundingBox->addPoint(h.boundingBox[0], h.boundingBox[1]);
+	a.boundingBox->addPoint(h.boundingBox[2], h.boundingBox[3]);
+
+	// the snapshot must hold exactly the trajectories of the dataset file, in the same order
+	if (h.numTrajectories < 0) {
+		std::cout << "Index snapshot is truncated or corrupt\n";
+		exit(1);
+	}
+	bool listed = a.trajectoryNames != nullptr;
+	if (!listed) {
+		a.trajectoryNames = new std::vector<std::string>(h.numTrajectories);
+	}
+	else if (a.trajectoryNames->size() != h.numTrajectories) {
+		std::cout << "Index snapshot holds " << h.numTrajectories << " trajectories, the dataset file lists " << a.trajectoryNames->size() << ": " << filename << "\n";
+		exit(1);
+	}
+	a.numTrajectories = h.numTrajectories;
+	a.trajectories = new std::vector<Trajectory*>(h.numTrajectories, nullptr);
+	std::string name;
+	for (int i = 0; i < h.numTrajectories; i++) {
+		SnapshotTrajectory rec = *r.take<SnapshotTrajectory>(1);
+		Trajectory *t = nullptr;
+		if (rec.size != 0) {
+			if (rec.uniqueIDInDataset != i) {
+				std::cout << "Index snapshot is truncated or corrupt\n";
+				exit(1);
+			}
+			t = new Trajectory();
+			readSnapshotTrajectory(r, rec, t);
+		}
+		int32_t nameLength = *r.take<int32_t>(1);
+		name.assign(r.take<char>(nameLength), nameLength);
+		if (listed && a.trajectoryNames->at(i) != name) {
+			std::cout << "Index snapshot was made from another dataset, trajectory " << i << " is " << name << " instead of " << a.trajectoryNames->at(i) << ": " << filename << "\n";
+			exit(1);
+		}
+		a.trajectoryNames->at(i) = name;
+		a.trajectories->at(i) = t;
+	}
+
+	a.diHash = nullptr;
+	a.endpointIndex = nullptr;
+	if (h.indexType == 1) {
+		a.endpointIndex = new EndpointIndex();
+		r.take(a.endpointIndex->entries);
+	}
+	else {
+		a.diHash = readSnapshotDiHash(r, *a.boundingBox);
+	}
+	// the mapping must stay alive as long as the trajectories
+	a.snapshot = file;
+	std::cout << "Loaded index snapshot: " << filename << "\n";
+}
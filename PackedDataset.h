@@ -0,0 +1,112 @@
+#pragma once
+
+#include "Vertex.h"
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <cstring>
+#include <cstdio>
+
+// Single file container holding all trajectories of a dataset (and optionally the query
+// trajectories), instead of one small file per trajectory. Written by FileIO::writePackedDataset,
+// read from a memory mapping so the vertices are used in place. Layout, offsets in bytes:
+//   Header
+//   Vertex blocks    one per trajectory, duplicate vertices already removed, 16 byte aligned
+//   Entry[count]     the trajectory directory, in dataset order
+//   names            referenced by the directory entries
+class PackedDataset {
+public:
+	struct Header {
+		char magic[8];
+		unsigned int version;
+		unsigned int count;
+		unsigned long long directoryOffset;
+		unsigned long long namesOffset;
+		unsigned long long size;
+		unsigned long long reserved;// keeps the vertex blocks 16 byte aligned
+	};
+
+	struct Entry {
+		unsigned long long vertexOffset;
+		unsigned long long nameOffset;
+		unsigned int vertexCount;
+		unsigned int nameLength;
+		unsigned int flags;
+		unsigned int padding;
+	};
+
+	// the trajectory is listed in the dataset, otherwise it is only there to be queried with
+	static const unsigned int IN_DATASET = 1;
+
+	static const char* magic() {
+		return "FRPACK1";
+	}
+
+	static const unsigned int version = 1;
+
+	const char *data = nullptr;
+	size_t size = 0;
+	// file contents, where the file is read instead of memory mapped
+	std::vector<char> storage;
+
+	// Checks the header and builds the name lookup, returns false for anything that is not a valid container
+	bool open(const char *iData, size_t iSize) {
+		data = iData;
+		size = iSize;
+		if (size < sizeof(Header)) return false;
+		Header &h = header();
+		if (memcmp(h.magic, magic(), 8) != 0 || h.version != version || h.size != size) return false;
+		if (h.directoryOffset + (unsigned long long)h.count * sizeof(Entry) > size || h.namesOffset > size) return false;
+		byName.clear();
+		byName.reserve(h.count);
+		for (int i = 0; i < h.count; i++) {
+			Entry &e = entry(i);
+			if (e.vertexOffset + (unsigned long long)e.vertexCount * sizeof(Vertex) > size || h.namesOffset + e.nameOffset + e.nameLength > size) {
+				return false;
+			}
+			byName[name(i)] = i;
+		}
+		return true;
+	}
+
+	int count() {
+		return header().count;
+	}
+
+	// index of the trajectory with the given name, -1 if it is not in the container
+	int find(const std::string &name) {
+		auto found = byName.find(name);
+		return found == byName.end() ? -1 : found->second;
+	}
+
+	Entry& entry(int i) {
+		return ((Entry*)(data + header().directoryOffset))[i];
+	}
+
+	std::string name(int i) {
+		Entry &e = entry(i);
+		return std::string(data + header().namesOffset + e.nameOffset, e.nameLength);
+	}
+
+	Vertex* vertices(int i) {
+		return (Vertex*)(data + entry(i).vertexOffset);
+	}
+
+	// true if the file starts with the container magic
+	static bool isPacked(const std::string &filename) {
+		FILE *file = fopen(filename.c_str(), "rb");
+		if (file == NULL) return false;
+		char head[8];
+		bool packed = fread(head, 1, 8, file) == 8 && memcmp(head, magic(), 8) == 0;
+		fclose(file);
+		return packed;
+	}
+
+private:
+	std::unordered_map<std::string, int> byName;
+
+	Header& header() {
+		return *(Header*)data;
+	}
+};
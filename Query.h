@@ -3,6 +3,7 @@
 #include "Trajectory.h"
 
 #include <string>
+#include <vector>
 
 // Represents a query in a queryset file
 // The queryNumber is the index in the query file,
@@ -11,4 +12,14 @@ struct Query {
 	std::string queryTrajectoryFilename;
 	double queryDelta;
 	int queryNumber;
-};
\ No newline at end of file
+	int knn = 0;// > 0 -> the k nearest trajectories are asked for, queryDelta is not used
+};
+
+// All range queries on the same query trajectory, made by the query planner.
+// The queries are sorted by increasing delta. A k nearest neighbour query is always a group of its own.
+struct QueryGroup {
+	std::string queryTrajectoryFilename;
+	std::vector<Query*> queries;
+	// estimated work (candidate vertices times query vertices), used by the scheduler
+	double estimatedCost = 0;
+};
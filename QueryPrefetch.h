@@ -0,0 +1,132 @@
+// Loads query trajectories ahead of the workers, included from Algorithm.h after AlgoSteps.h
+#pragma once
+
+#include <vector>
+#include <unordered_set>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <chrono>
+
+// Loads and simplifies the query trajectories that are not in the dataset on a dedicated thread,
+// into a bounded number of slots (the prefetch depth), in the order the scheduler is expected to
+// hand out their groups. A worker takes the trajectory of its group from a slot, waiting when it is
+// still being loaded, and releases the slot when the group is solved. Groups the prefetcher has not
+// reached yet are loaded by the worker itself, and skipped by the prefetcher.
+class QueryPrefetcher {
+	struct Slot {
+		QueryGroup *group = nullptr;// nullptr -> free
+		Trajectory *trajectory = nullptr;
+		bool ready = false;
+		Arena arena;
+	};
+
+	std::vector<QueryGroup*> order;
+	std::vector<Slot*> slots;
+	// groups that were loaded, or are being loaded, by the prefetcher or a worker
+	std::unordered_set<QueryGroup*> claimed;
+	std::mutex mtx;
+	std::condition_variable changed;
+	std::thread *thread = nullptr;
+	AlgoData *a = nullptr;
+	AlgorithmObjects *algo = nullptr;
+	bool stop = false;
+
+	int slotOf(QueryGroup *group) {
+		for (int i = 0; i < slots.size(); i++) {
+			if (slots[i]->group == group) return i;
+		}
+		return -1;
+	}
+
+	void run() {
+		for (QueryGroup *group : order) {
+			std::unique_lock<std::mutex> lock(mtx);
+			changed.wait(lock, [&]() -> bool { return stop || claimed.count(group) > 0 || slotOf(nullptr) != -1; });
+			if (stop) return;
+			if (claimed.count(group) > 0) continue;
+			claimed.insert(group);
+			Slot *slot = slots[slotOf(nullptr)];
+			slot->group = group;
+			slot->ready = false;
+			lock.unlock();
+
+			// the slot belongs to the prefetcher until it is ready
+			slot->arena.reset();
+			Trajectory *t = algo->fio.parseTrajectoryFile(group->queryTrajectoryFilename, -1, slot->arena);
+			makeQuerySimplifications(*a, *t, *algo, slot->arena);
+
+			lock.lock();
+			slot->trajectory = t;
+			slot->ready = true;
+			prefetched++;
+			changed.notify_all();
+		}
+	}
+
+public:
+	// statistics
+	int prefetched = 0;
+	int loadedByWorkers = 0;
+
+	~QueryPrefetcher() {
+		finish();
+		for (Slot *s : slots) {
+			delete s;
+		}
+		delete algo;
+	}
+
+	void start(AlgoData *iA, std::vector<QueryGroup*> &iOrder, int depth) {
+		a = iA;
+		order = iOrder;
+		for (int i = 0; i < depth; i++) {
+			slots.push_back(new Slot());
+		}
+		algo = new AlgorithmObjects();
+		algo->fio.sharePackedDataset(a->fio);
+		thread = new std::thread(&QueryPrefetcher::run, this);
+	}
+
+	// Returns the prefetched query trajectory of group, waiting until it is loaded, and adds the time
+	// waited to waitSec. Returns nullptr if the prefetcher did not get to the group, the caller loads it.
+	Trajectory* take(QueryGroup *group, double &waitSec) {
+		std::unique_lock<std::mutex> lock(mtx);
+		int s = slotOf(group);
+		if (s == -1) {
+			claimed.insert(group);
+			loadedByWorkers++;
+			return nullptr;
+		}
+		Slot *slot = slots[s];
+		if (!slot->ready) {
+			auto started = std::chrono::steady_clock::now();
+			changed.wait(lock, [&]() -> bool { return slot->ready; });
+			waitSec += std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+		}
+		return slot->trajectory;
+	}
+
+	// Frees the slot of a group taken from the prefetcher
+	void release(QueryGroup *group) {
+		std::lock_guard<std::mutex> lock(mtx);
+		Slot *slot = slots[slotOf(group)];
+		deleteQueryTrajectory(slot->trajectory);
+		slot->trajectory = nullptr;
+		slot->group = nullptr;
+		slot->ready = false;
+		changed.notify_all();
+	}
+
+	// Stops loading and waits for the thread
+	void finish() {
+		if (thread == nullptr) return;
+		mtx.lock();
+		stop = true;
+		changed.notify_all();
+		mtx.unlock();
+		thread->join();
+		delete thread;
+		thread = nullptr;
+	}
+};
@@ -0,0 +1,247 @@
+// Work-stealing scheduler handing out query groups to the worker threads
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <functional>
+#include <algorithm>
+
+struct AlgorithmObjects;
+
+// Part of a query split into chunks, which idle workers can help with.
+// run is called once for every chunk, with the buffers of the worker running it.
+struct SharedJob {
+	std::function< void(int chunk, AlgorithmObjects *algo) > run;
+	int numChunks = 0;
+	std::atomic<int> nextChunk{ 0 };
+	std::atomic<int> helpers{ 0 };
+};
+
+// Every worker has its own deque of jobs. The jobs are dealt out by estimated cost,
+// most expensive first, so the expensive jobs start early and the total cost per worker
+// is balanced. A worker takes jobs from the front of its own deque. When that is empty it
+// steals from the back of the deque with the most remaining cost.
+// Workers without jobs help with the shared jobs of workers that are still solving,
+// until all workers are done.
+class QueryScheduler {
+	struct WorkerQueue {
+		std::mutex mtx;
+		std::deque<int> jobs;
+		double remainingCost = 0;
+	};
+
+	std::vector<WorkerQueue*> queues;
+	std::vector<double> costs;
+
+	// shared jobs and the number of workers that still have jobs, guarded by helpMtx
+	std::mutex helpMtx;
+	std::condition_variable helpCv;
+	std::vector<SharedJob*> shared;
+	int active = 0;
+
+	// runs chunks of job until all chunks are taken, returns the number of chunks run
+	int runChunks(SharedJob *job, AlgorithmObjects *algo) {
+		int chunk;
+		int count = 0;
+		while ((chunk = job->nextChunk.fetch_add(1)) < job->numChunks) {
+			job->run(chunk, algo);
+			count++;
+		}
+		return count;
+	}
+
+	// a shared job with chunks left, nullptr if there is none. Needs helpMtx.
+	SharedJob* openJob() {
+		for (SharedJob *j : shared) {
+			if (j->nextChunk.load() < j->numChunks) {
+				return j;
+			}
+		}
+		return nullptr;
+	}
+
+public:
+	// load balance statistics, per worker
+	struct WorkerStats {
+		double busySec = 0;
+		double idleSec = 0;
+		int solved = 0;
+		int stolen = 0;
+		int helped = 0;// chunks of other workers' jobs
+		double prefetchWaitSec = 0;// waiting for the query prefetcher
+	};
+	std::vector<WorkerStats> stats;
+
+	// called whenever a shared job is added, for pools whose idle workers wait elsewhere than in
+	// help() (see FrechetIndex). They check hasSharedWork and call tryHelp.
+	std::function< void() > onShared;
+
+	~QueryScheduler() {
+		for (WorkerQueue *q : queues) {
+			delete q;
+		}
+	}
+
+	// deals out jobs 0..jobCosts.size() - 1 over numWorkers deques
+	void init(int numWorkers, std::vector<double> &jobCosts) {
+		costs = jobCosts;
+		for (int w = 0; w < numWorkers; w++) {
+			queues.push_back(new WorkerQueue());
+		}
+		stats.resize(numWorkers);
+		active = numWorkers;
+
+		std::vector<int> order(costs.size());
+		for (int i = 0; i < order.size(); i++) {
+			order[i] = i;
+		}
+		std::stable_sort(order.begin(), order.end(), [&](int l, int r) -> bool {
+			return costs[l] > costs[r];
+		});
+		// greedy: the next most expensive job goes to the worker with the least work
+		for (int job : order) {
+			WorkerQueue *least = queues[0];
+			for (WorkerQueue *q : queues) {
+				if (q->remainingCost < least->remainingCost) {
+					least = q;
+				}
+			}
+			least->jobs.push_back(job);
+			least->remainingCost += costs[job];
+		}
+	}
+
+	// The order jobs are expected to be handed out in, before any are: the fronts
+	// of the worker deques, round robin
+	std::vector<int> plannedOrder() {
+		std::vector<int> order;
+		for (int position = 0; order.size() < costs.size(); position++) {
+			for (WorkerQueue *q : queues) {
+				if (position < q->jobs.size()) {
+					order.push_back(q->jobs[position]);
+				}
+			}
+		}
+		return order;
+	}
+
+	// Gets the next job for a worker, returns false when no jobs are left
+	bool next(int worker, int &job) {
+		WorkerQueue *own = queues[worker];
+		own->mtx.lock();
+		if (!own->jobs.empty()) {
+			job = own->jobs.front();
+			own->jobs.pop_front();
+			own->remainingCost -= costs[job];
+			own->mtx.unlock();
+			return true;
+		}
+		own->mtx.unlock();
+
+		// steal, retry as long as some deque still has jobs
+		while (true) {
+			WorkerQueue *victim = nullptr;
+			double most = -1;
+			for (WorkerQueue *q : queues) {
+				q->mtx.lock();
+				if (!q->jobs.empty() && q->remainingCost > most) {
+					most = q->remainingCost;
+					victim = q;
+				}
+				q->mtx.unlock();
+			}
+			if (victim == nullptr) {
+				return false;
+			}
+			victim->mtx.lock();
+			if (!victim->jobs.empty()) {
+				job = victim->jobs.back();
+				victim->jobs.pop_back();
+				victim->remainingCost -= costs[job];
+				victim->mtx.unlock();
+				stats[worker].stolen++;
+				return true;
+			}
+			victim->mtx.unlock();
+		}
+	}
+
+	// Solves job together with any idle workers, returns when all chunks are done
+	void runShared(SharedJob *job, AlgorithmObjects *algo) {
+		helpMtx.lock();
+		shared.push_back(job);
+		helpMtx.unlock();
+		helpCv.notify_all();
+		if (onShared) {
+			onShared();
+		}
+
+		runChunks(job, algo);
+
+		// no new helpers after this, wait for the ones still working on a chunk
+		helpMtx.lock();
+		shared.erase(std::find(shared.begin(), shared.end(), job));
+		helpMtx.unlock();
+		while (job->helpers.load() > 0) {
+			std::this_thread::yield();
+		}
+	}
+
+	// Called by a worker once next() returned false, it will not get jobs anymore
+	void finished() {
+		helpMtx.lock();
+		active--;
+		helpMtx.unlock();
+		helpCv.notify_all();
+	}
+
+	// Waits for a shared job with chunks left and helps with it. Returns false
+	// when all workers are done, so no shared jobs can appear anymore.
+	bool help(int worker, AlgorithmObjects *algo) {
+		std::unique_lock<std::mutex> lock(helpMtx);
+		SharedJob *job = nullptr;
+		helpCv.wait(lock, [&]() -> bool {
+			job = openJob();
+			return job != nullptr || active == 0;
+		});
+		if (job == nullptr) {
+			return false;
+		}
+		job->helpers++;
+		lock.unlock();
+
+		// only the time spent on chunks counts as busy
+		auto started = std::chrono::steady_clock::now();
+		stats[worker].helped += runChunks(job, algo);
+		stats[worker].busySec += std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+		job->helpers--;
+		return true;
+	}
+
+	// true if a shared job has chunks left
+	bool hasSharedWork() {
+		std::lock_guard<std::mutex> lock(helpMtx);
+		return openJob() != nullptr;
+	}
+
+	// Helps with a shared job if one has chunks left, without waiting for one. Returns false if there was none.
+	bool tryHelp(AlgorithmObjects *algo) {
+		SharedJob *job;
+		{
+			std::lock_guard<std::mutex> lock(helpMtx);
+			job = openJob();
+			if (job == nullptr) {
+				return false;
+			}
+			job->helpers++;
+		}
+		runChunks(job, algo);
+		job->helpers--;
+		return true;
+	}
+};
@@ -0,0 +1,417 @@
+// Resident query server, keeps the preprocessed dataset in memory and answers queries sent by clients.
+// Included from FrechetCompImpl.cpp after Algorithm.h
+#pragma once
+
+#include "Algorithm.h"
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <sstream>
+#include <cstdio>
+#include <iostream>
+#include <algorithm>
+#include <cstring>
+#ifndef _WIN32
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <signal.h>
+#endif
+
+// Line protocol, one request per line, answered in any order:
+//   <id> range <delta> <trajectory file>
+//   <id> knn <k> <trajectory file>
+//   <id> range <delta> points <x1> <y1> <x2> <y2> ...     (also for knn, the query trajectory is sent inline)
+//   shutdown                                             (stops the server once running requests are answered)
+// Every request is answered with the same block as in results.txt, with the id of the request:
+//   query <id> <number of results>
+//   <one result per line, "name distance" for knn>
+// or with a single "error <id> <message>" line. The id is chosen by the client, it is not interpreted.
+// Requests of all clients are queued for a pool of numWorkers workers, so requests sent on one
+// connection without waiting for their answers are solved concurrently. While maxQueued requests
+// wait for a worker, no further requests are read.
+class QueryServer {
+	// A client, either a unix socket connection or stdin/stdout (fd -1)
+	struct Connection {
+		int fd = -1;
+		std::mutex writeMtx;
+		std::mutex pendingMtx;
+		std::condition_variable answered;
+		int pending = 0;// requests queued or being solved
+
+		void send(const std::string &text) {
+			std::lock_guard<std::mutex> lock(writeMtx);
+			if (fd == -1) {
+				fwrite(text.data(), 1, text.size(), stdout);
+				fflush(stdout);
+				return;
+			}
+#ifndef _WIN32
+			size_t sent = 0;
+			while (sent < text.size()) {
+				ssize_t n = write(fd, text.data() + sent, text.size() - sent);
+				if (n <= 0) return;// client went away, the answer is dropped
+				sent += n;
+			}
+#endif
+		}
+
+		// Reads the next line into line, false at the end of the input
+		bool readLine(std::string &line) {
+			if (fd == -1) {
+				return (bool)std::getline(std::cin, line);
+			}
+#ifndef _WIN32
+			while (true) {
+				size_t eol = input.find('\n');
+				if (eol != std::string::npos) {
+					line = input.substr(0, eol);
+					input.erase(0, eol + 1);
+					return true;
+				}
+				char buffer[4096];
+				ssize_t n = read(fd, buffer, sizeof(buffer));
+				if (n <= 0) {
+					// a last line without newline
+					line = input;
+					input.clear();
+					return !line.empty();
+				}
+				input.append(buffer, n);
+			}
+#else
+			return false;
+#endif
+		}
+
+	private:
+		std::string input;
+	};
+
+	struct Request {
+		std::shared_ptr<Connection> connection;
+		std::string id;
+		Query query;
+		std::vector<Vertex> points;// inline query trajectory, empty when a file is queried
+		std::chrono::steady_clock::time_point received;
+	};
+
+	AlgoData *a;
+	std::deque<Request*> queue;
+	std::mutex mtx;
+	std::condition_variable queued;
+	std::condition_variable spaceLeft;
+	bool stopping = false;// no new connections and requests
+	bool finished = false;// all requests are answered, workers exit
+	int listenFd = -1;
+	// open socket connections, each has a detached reader thread
+	std::vector<std::shared_ptr<Connection>> connections;
+	std::condition_variable closed;
+	long accepted = 0;
+	std::vector<std::thread*> workers;
+
+	std::atomic<long> served{ 0 };
+	std::atomic<long> failed{ 0 };
+	std::atomic<long> busyMicros{ 0 };
+	std::atomic<long> latencyMicros{ 0 };
+
+	// Parses a request line, returns an empty string or the reason it is invalid
+	std::string parse(const std::string &line, Request &r) {
+		std::istringstream in(line);
+		std::string type;
+		if (!(in >> r.id >> type)) return "expected: <id> range|knn <delta|k> <file>|points <x y ...>";
+		if (type == "range") {
+			if (!(in >> r.query.queryDelta) || r.query.queryDelta < 0) return "invalid delta";
+			r.query.knn = 0;
+		}
+		else if (type == "knn") {
+			if (!(in >> r.query.knn) || r.query.knn <= 0) return "invalid k";
+			r.query.queryDelta = 0;
+		}
+		else {
+			return "unknown query type " + type;
+		}
+		std::string target;
+		if (!(in >> target)) return "missing query trajectory";
+		if (target == "points") {
+			Vertex v;
+			while (in >> v.x) {
+				if (!(in >> v.y)) return "odd number of coordinates";
+				r.points.push_back(v);
+			}
+			if (!in.eof()) return "invalid coordinate";
+			if (r.points.empty()) return "no points";
+			r.query.queryTrajectoryFilename = "points";
+		}
+		else {
+			std::string rest;
+			if (in >> rest) return "unexpected " + rest;
+			if (a->datasetIndex.count(target) == 0 && !a->fio.trajectoryExists(target)) return "cannot open " + target;
+			r.query.queryTrajectoryFilename = target;
+		}
+		return "";
+	}
+
+	// Formats the answer of a solved request like a block of the consolidated results file
+	void answer(Request &r, AlgorithmObjects *algo, std::vector<std::vector<Trajectory*>> &results) {
+		std::string text;
+		char number[64];
+		if (r.query.knn > 0) {
+			snprintf(number, sizeof(number), " %zu\n", algo->nearest.size());
+			text = "query " + r.id + number;
+			for (std::pair<double, Trajectory*> &n : algo->nearest) {
+				snprintf(number, sizeof(number), " %.15g\n", n.first);
+				text += n.second->name;
+				text += number;
+			}
+		}
+		else {
+			snprintf(number, sizeof(number), " %zu\n", results[0].size());
+			text = "query " + r.id + number;
+			for (Trajectory *t : results[0]) {
+				text += t->name;
+				text += '\n';
+			}
+		}
+		r.connection->send(text);
+	}
+
+	void solve(Request &r, AlgorithmObjects *algo) {
+		QueryGroup group;
+		group.queryTrajectoryFilename = r.query.queryTrajectoryFilename;
+		group.queries.push_back(&r.query);
+		bool cached = false;
+		Trajectory *queryTrajectory;
+		if (!r.points.empty()) {
+			queryTrajectory = algo->fio.makeTrajectory(r.points, "points", -1, algo->queryArena);
+			makeQuerySimplifications(*a, *queryTrajectory, *algo, algo->queryArena);
+		}
+		else {
+			queryTrajectory = getQueryTrajectory(a, group.queryTrajectoryFilename, algo, cached);
+		}
+		if (queryTrajectory->size < 2) {
+			r.connection->send("error " + r.id + " query trajectory needs at least 2 distinct vertices\n");
+			failed++;
+		}
+		else {
+			std::vector<std::vector<Trajectory*>> results;
+			solveGroupOn(a, group, algo, queryTrajectory, results);
+			answer(r, algo, results);
+			served++;
+		}
+		releaseQueryTrajectory(a, group, algo, queryTrajectory, cached, false);
+	}
+
+	void worker(AlgorithmObjects *algo) {
+		while (true) {
+			Request *r;
+			{
+				std::unique_lock<std::mutex> lock(mtx);
+				queued.wait(lock, [&]() -> bool { return finished || !queue.empty(); });
+				if (queue.empty()) break;
+				r = queue.front();
+				queue.pop_front();
+			}
+			spaceLeft.notify_one();
+			auto started = std::chrono::steady_clock::now();
+			solve(*r, algo);
+			auto now = std::chrono::steady_clock::now();
+			busyMicros += std::chrono::duration_cast<std::chrono::microseconds>(now - started).count();
+			latencyMicros += std::chrono::duration_cast<std::chrono::microseconds>(now - r->received).count();
+			done(*r->connection);
+			delete r;
+		}
+		delete algo;
+	}
+
+	void done(Connection &c) {
+		std::lock_guard<std::mutex> lock(c.pendingMtx);
+		c.pending--;
+		c.answered.notify_all();
+	}
+
+	// Reads the requests of a connection until it is closed, then waits for their answers
+	void reader(std::shared_ptr<Connection> c) {
+		std::string line;
+		while (c->readLine(line)) {
+			if (!line.empty() && line.back() == '\r') line.pop_back();
+			if (line.find_first_not_of(" \t") == std::string::npos) continue;
+			if (line == "shutdown") {
+				stop();
+				break;
+			}
+			Request *r = new Request();
+			r->connection = c;
+			r->received = std::chrono::steady_clock::now();
+			std::string error = parse(line, *r);
+			if (!error.empty()) {
+				c->send("error " + (r->id.empty() ? std::string("-") : r->id) + " " + error + "\n");
+				failed++;
+				delete r;
+				continue;
+			}
+			{
+				std::lock_guard<std::mutex> lock(c->pendingMtx);
+				c->pending++;
+			}
+			{
+				// stop reading while the queue is full, so a client sending faster than the
+				// workers solve is held back by its connection instead of growing the queue
+				std::unique_lock<std::mutex> lock(mtx);
+				spaceLeft.wait(lock, [&]() -> bool { return queue.size() < maxQueued; });
+				queue.push_back(r);
+			}
+			queued.notify_one();
+		}
+		{
+			std::unique_lock<std::mutex> lock(c->pendingMtx);
+			c->answered.wait(lock, [&]() -> bool { return c->pending == 0; });
+		}
+#ifndef _WIN32
+		if (c->fd != -1) {
+			std::lock_guard<std::mutex> lock(mtx);
+			close(c->fd);
+			connections.erase(std::find(connections.begin(), connections.end(), c));
+			closed.notify_all();
+		}
+#endif
+	}
+
+	// Stops accepting connections and reading requests, requests already queued are still answered
+	void stop() {
+		std::lock_guard<std::mutex> lock(mtx);
+		if (stopping) return;
+		stopping = true;
+#ifndef _WIN32
+		if (listenFd != -1) {
+			::shutdown(listenFd, SHUT_RDWR);
+		}
+		for (std::shared_ptr<Connection> &c : connections) {
+			::shutdown(c->fd, SHUT_RD);
+		}
+#endif
+	}
+
+	void startWorkers() {
+		for (int i = 0; i < a->numWorkers; i++) {
+			AlgorithmObjects *algo = new AlgorithmObjects();
+			algo->fio.sharePackedDataset(a->fio);
+			algo->arena = new Arena();
+			a->arenas.push_back(algo->arena);
+			workers.push_back(new std::thread(&QueryServer::worker, this, algo));
+		}
+	}
+
+	void stopWorkers() {
+		{
+			std::lock_guard<std::mutex> lock(mtx);
+			finished = true;
+		}
+		queued.notify_all();
+		for (std::thread *t : workers) {
+			t->join();
+			delete t;
+		}
+		workers.clear();
+	}
+
+	void printStats() {
+		long n = served + failed;
+		std::cout << "Served " << served << " requests (" << failed << " failed) from " << std::max(1L, accepted)
+			<< " connections, average latency " << (n > 0 ? latencyMicros / 1000.0 / n : 0) << " ms, average solve "
+			<< (n > 0 ? busyMicros / 1000.0 / n : 0) << " ms\n";
+	}
+
+public:
+	// requests waiting for a worker before the readers wait for them
+	int maxQueued = 256;
+
+	QueryServer(AlgoData *iA) : a(iA) {}
+
+	// Answers requests read from stdin on stdout until stdin is closed or "shutdown" is read.
+	// The rest of the output of the program must not go to stdout, see runServer.
+	void serveStdin() {
+		startWorkers();
+		std::cout << "Serving on stdin\n";
+		std::shared_ptr<Connection> c(new Connection());
+		reader(c);
+		stopWorkers();
+		printStats();
+	}
+
+	// Accepts clients on a unix domain socket at path until a client sends "shutdown"
+	void serveSocket(const std::string &path) {
+#ifndef _WIN32
+		signal(SIGPIPE, SIG_IGN);// clients closing early must not end the server
+		sockaddr_un address;
+		memset(&address, 0, sizeof(address));
+		address.sun_family = AF_UNIX;
+		if (path.size() >= sizeof(address.sun_path)) {
+			std::cout << "Socket path too long: " << path << "\n";
+			exit(1);
+		}
+		strcpy(address.sun_path, path.c_str());
+		unlink(path.c_str());
+		listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (listenFd < 0 || bind(listenFd, (sockaddr*)&address, sizeof(address)) != 0 || listen(listenFd, 64) != 0) {
+			std::cout << "Failed to listen on: " << path << "\n";
+			exit(1);
+		}
+		startWorkers();
+		std::cout << "Serving on " << path << "\n" << std::flush;
+		while (true) {
+			int fd = accept(listenFd, NULL, NULL);
+			std::lock_guard<std::mutex> lock(mtx);
+			if (stopping) {
+				if (fd >= 0) close(fd);
+				break;
+			}
+			if (fd < 0) continue;
+			std::shared_ptr<Connection> c(new Connection());
+			c->fd = fd;
+			connections.push_back(c);
+			accepted++;
+			std::thread(&QueryServer::reader, this, c).detach();
+		}
+		{
+			// the readers end once their connection is closed by the client or by stop
+			std::unique_lock<std::mutex> lock(mtx);
+			closed.wait(lock, [&]() -> bool { return connections.empty(); });
+		}
+		stopWorkers();
+		close(listenFd);
+		unlink(path.c_str());
+		printStats();
+#else
+		std::cout << "Unix domain sockets are not supported on this platform, use --serve -\n";
+		exit(1);
+#endif
+	}
+};
+
+// Entrypoint for server mode: preprocesses the dataset once, then answers queries
+// on the unix socket at path, or on stdin/stdout for path "-". In that case std::cout
+// must already be redirected (see main), stdout only carries answers.
+inline void runServer(AlgoData *a, const std::string &path) {
+	long timeMS = std::chrono::system_clock::now().time_since_epoch() /
+		std::chrono::milliseconds(1);
+	std::cout << " - Preprocess\n";
+	preprocessDataSet(a);
+	printMS("PREPROCESSING", std::chrono::system_clock::now().time_since_epoch() /
+		std::chrono::milliseconds(1) - timeMS);
+	QueryServer server(a);
+	if (path == "-") {
+		server.serveStdin();
+	}
+	else {
+		server.serveSocket(path);
+	}
+	cleanup(a);
+}
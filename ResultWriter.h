@@ -0,0 +1,205 @@
+#pragma once
+
+#include "Trajectory.h"
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <cstdio>
+#include <iostream>
+
+// Writes the query results on a dedicated thread. Workers format their results into their own
+// buffer, which is handed to the writer thread once it is full (and when the worker is done),
+// so workers never wait on file creation or the filesystem.
+// By default all results go to one consolidated file, every query as a block:
+//   query <query number> <number of results>
+//   <one result per line>
+// in the order the queries were solved. Alternatively every query gets its own
+// result-XXXXX.txt file with just the result lines, as before.
+// Without any query blocks (see append) a buffer is written as is, used for the join output.
+class ResultWriter {
+public:
+	struct Block {
+		int queryNumber;
+		size_t end;// end of the result lines of the query in the buffer text
+	};
+
+	struct Buffer {
+		std::string text;
+		std::vector<Block> blocks;
+	};
+
+	// a worker hands its buffer over once it holds this many bytes
+	size_t flushBytes = 1 << 16;
+	// buffers waiting for the writer thread before workers wait for it
+	int maxQueued = 64;
+
+	long bytesWritten = 0;
+	long filesWritten = 0;
+
+	// Opens the consolidated file (when not writing a file per query) and starts the writer thread
+	void start(const std::string &iFilename, bool iPerQuery) {
+		filename = iFilename;
+		perQuery = iPerQuery;
+		if (!perQuery) {
+			out = fopen(filename.c_str(), "wb");
+			if (out == NULL) {
+				std::cout << "Failed to open: " << filename << "\n";
+				exit(1);
+			}
+			filesWritten = 1;
+		}
+		done = false;
+		thread = new std::thread(&ResultWriter::run, this);
+	}
+
+	// An empty buffer for a worker
+	Buffer* acquire() {
+		std::lock_guard<std::mutex> lock(mtx);
+		if (spare.empty()) {
+			return new Buffer();
+		}
+		Buffer *buffer = spare.back();
+		spare.pop_back();
+		return buffer;
+	}
+
+	// Hands the buffer to the writer thread and replaces it with an empty one
+	void submit(Buffer *&buffer) {
+		{
+			std::unique_lock<std::mutex> lock(mtx);
+			spaceLeft.wait(lock, [&]() -> bool { return queue.size() < maxQueued; });
+			queue.push_back(buffer);
+		}
+		queued.notify_one();
+		buffer = acquire();
+	}
+
+	// Writes the results of a range query
+	void writeRange(Buffer *&buffer, int queryNumber, std::vector<Trajectory*> &results) {
+		beginQuery(*buffer, queryNumber, results.size());
+		for (Trajectory *t : results) {
+			buffer->text += t->name;
+			buffer->text += '\n';
+		}
+		endQuery(buffer, queryNumber);
+	}
+
+	// Writes the results of a k nearest neighbour query, "name distance" per line
+	void writeKnn(Buffer *&buffer, int queryNumber, std::vector<std::pair<double, Trajectory*>> &results) {
+		beginQuery(*buffer, queryNumber, results.size());
+		char number[32];
+		for (std::pair<double, Trajectory*> &n : results) {
+			snprintf(number, sizeof(number), "%.15g", n.first);
+			buffer->text += n.second->name;
+			buffer->text += ' ';
+			buffer->text += number;
+			buffer->text += '\n';
+		}
+		endQuery(buffer, queryNumber);
+	}
+
+	// Adds text that does not belong to a query, only for the consolidated file
+	void append(Buffer *&buffer, const std::string &text) {
+		buffer->text += text;
+		if (buffer->text.size() >= flushBytes) {
+			submit(buffer);
+		}
+	}
+
+	// Writes everything that was submitted, then stops the writer thread and closes the file
+	void finish() {
+		{
+			std::lock_guard<std::mutex> lock(mtx);
+			done = true;
+		}
+		queued.notify_one();
+		thread->join();
+		delete thread;
+		thread = nullptr;
+		if (out != NULL) {
+			fclose(out);
+			out = NULL;
+		}
+		for (Buffer *buffer : spare) {
+			delete buffer;
+		}
+		spare.clear();
+	}
+
+private:
+	std::string filename;
+	bool perQuery = false;
+	FILE *out = NULL;
+	std::deque<Buffer*> queue;
+	std::vector<Buffer*> spare;
+	std::mutex mtx;
+	std::condition_variable queued;
+	std::condition_variable spaceLeft;
+	std::thread *thread = nullptr;
+	bool done = false;
+
+	void beginQuery(Buffer &buffer, int queryNumber, size_t count) {
+		if (!perQuery) {
+			char header[64];
+			snprintf(header, sizeof(header), "query %05d %zu\n", queryNumber, count);
+			buffer.text += header;
+		}
+	}
+
+	void endQuery(Buffer *&buffer, int queryNumber) {
+		buffer->blocks.push_back({ queryNumber, buffer->text.size() });
+		if (buffer->text.size() >= flushBytes) {
+			submit(buffer);
+		}
+	}
+
+	void write(FILE *file, const std::string &name, const char *data, size_t size) {
+		if (size > 0 && fwrite(data, 1, size, file) != size) {
+			std::cout << "Failed to write: " << name << "\n";
+			exit(1);
+		}
+		bytesWritten += size;
+	}
+
+	void writeBuffer(Buffer &buffer) {
+		if (!perQuery) {
+			write(out, filename, buffer.text.data(), buffer.text.size());
+			return;
+		}
+		size_t begin = 0;
+		char name[32];
+		for (Block &block : buffer.blocks) {
+			snprintf(name, sizeof(name), "result-%05d.txt", block.queryNumber);
+			FILE *file = fopen(name, "wb");
+			if (file == NULL) {
+				std::cout << "Failed to open: " << name << "\n";
+				exit(1);
+			}
+			write(file, name, buffer.text.data() + begin, block.end - begin);
+			fclose(file);
+			filesWritten++;
+			begin = block.end;
+		}
+	}
+
+	void run() {
+		std::unique_lock<std::mutex> lock(mtx);
+		while (true) {
+			queued.wait(lock, [&]() -> bool { return done || !queue.empty(); });
+			if (queue.empty()) return;
+			Buffer *buffer = queue.front();
+			queue.pop_front();
+			lock.unlock();
+			spaceLeft.notify_all();
+			writeBuffer(*buffer);
+			buffer->text.clear();
+			buffer->blocks.clear();
+			lock.lock();
+			spare.push_back(buffer);
+		}
+	}
+};
@@ -3,10 +3,11 @@
 
 #include "Vertex.h"
 #include "BoundingBox.h"
+#include "Arena.h"
 #include <iostream>
 #include <string>
 #include <vector>
-#include <map>
+#include <algorithm>
 
 
 
@@ -17,29 +18,112 @@ struct Portal {
 	double distance;
 };
 
-bool portalCompare(Portal &lhs, Portal &rhs) { return lhs.destination < rhs.destination; }
+inline bool portalCompare(const Portal &lhs, const Portal &rhs) { return lhs.destination < rhs.destination; }
+
+inline bool portalSourceCompare(const Portal &lhs, const Portal &rhs) {
+	return lhs.source < rhs.source || (lhs.source == rhs.source && lhs.destination < rhs.destination);
+}
+
+inline bool portalSameJump(const Portal &lhs, const Portal &rhs) {
+	return lhs.source == rhs.source && lhs.destination == rhs.destination;
+}
+
+// Freespace jumps of a trajectory, frozen after preprocessing and only read afterwards.
+// Jumps starting at row r are at [offsets[r], offsets[r + 1]) in portals, sorted by destination.
+class PortalTable {
+public:
+	ArenaArray<int> offsets;
+	ArenaArray<Portal> portals;
+
+	// Builds the table from unsorted candidate jumps, keeping the first of each duplicate
+	// (source, destination) pair. numRows is the number of vertices of the trajectory.
+	void build(std::vector<Portal> &candidates, int numRows, Arena &arena) {
+		std::stable_sort(candidates.begin(), candidates.end(), portalSourceCompare);
+		candidates.erase(std::unique(candidates.begin(), candidates.end(), portalSameJump), candidates.end());
+		if (candidates.empty()) {
+			// no jumps, begin and end return an empty range for every row
+			return;
+		}
+		portals.assign(arena, candidates);
+		offsets.allocate(arena, numRows + 1);
+		for (int r = 0; r <= numRows; r++) {
+			offsets[r] = 0;
+		}
+		for (Portal &p : portals) {
+			offsets[p.source + 1]++;
+		}
+		for (int r = 0; r < numRows; r++) {
+			offsets[r + 1] += offsets[r];
+		}
+	}
+
+	const Portal* begin(int row) const {
+		return row + 1 < offsets.size() ? &portals[0] + offsets[row] : nullptr;
+	}
+
+	const Portal* end(int row) const {
+		return row + 1 < offsets.size() ? &portals[0] + offsets[row + 1] : nullptr;
+	}
+};
 
 class TrajectorySimplification;
 
+// All per-vertex arrays of a trajectory are views into an Arena, which owns the memory.
+// A trajectory must not outlive the arena its data was allocated from.
 class Trajectory {
 public: 
 	std::string name;
 	
-	std::vector<Vertex> vertices;// all vertices of traj
-	std::vector<double> distances;// distance between vertices
-	std::vector<double> totals;// total length at vertex x
-	std::vector<int> sourceIndex;// mapping back to the source trajectory if this is a simplification
-	std::map<int, std::vector<Portal>> simpPortals;// freespace jumps
+	ArenaArray<Vertex> vertices;// all vertices of traj
+	ArenaArray<double> distances;// distance between vertices
+	ArenaArray<double> totals;// total length at vertex x
+	ArenaArray<int> sourceIndex;// mapping back to the source trajectory if this is a simplification
+	ArenaArray<Segment> segments;// segments[i] goes from vertex i to vertex i + 1
+	PortalTable simpPortals;// freespace jumps
 
 	int size;
 	int uniqueIDInDataset;
 	double totalLength;
 
-	BoundingBox *boundingBox;
+	BoundingBox boundingBox;
 	std::vector<TrajectorySimplification*> simplifications;
 
-	~Trajectory() {
-		delete boundingBox;
+	// fills the segment table from the vertices, distances must be set
+	void computeSegments(Arena &arena) {
+		segments.allocate(arena, size > 0 ? size - 1 : 0);
+		for (int i = 0; i + 1 < size; i++) {
+			Segment &s = segments[i];
+			s.dx = vertices[i + 1].x - vertices[i].x;
+			s.dy = vertices[i + 1].y - vertices[i].y;
+			s.lengthSQ = s.dx * s.dx + s.dy * s.dy;
+			s.invLength = distances[i + 1] > 0 ? 1 / distances[i + 1] : 0;
+		}
+	}
+
+	// copies all per-vertex arrays into arena, used to keep a trajectory that was built in a scratch arena
+	void copyInto(Arena &arena) {
+		vertices.assign(arena, vertices.data(), vertices.size());
+		distances.assign(arena, distances.data(), distances.size());
+		totals.assign(arena, totals.data(), totals.size());
+		sourceIndex.assign(arena, sourceIndex.data(), sourceIndex.size());
+		segments.assign(arena, segments.data(), segments.size());
+		simpPortals.offsets.assign(arena, simpPortals.offsets.data(), simpPortals.offsets.size());
+		simpPortals.portals.assign(arena, simpPortals.portals.data(), simpPortals.portals.size());
+	}
+
+	// makes this trajectory share the per-vertex arrays of other, nothing is copied.
+	// Simplifications and jumps are not shared.
+	void viewOf(Trajectory &other) {
+		name = other.name;
+		vertices.view(other.vertices.data(), other.vertices.size());
+		distances.view(other.distances.data(), other.distances.size());
+		totals.view(other.totals.data(), other.totals.size());
+		sourceIndex.view(other.sourceIndex.data(), other.sourceIndex.size());
+		segments.view(other.segments.data(), other.segments.size());
+		size = other.size;
+		uniqueIDInDataset = other.uniqueIDInDataset;
+		totalLength = other.totalLength;
+		boundingBox = other.boundingBox;
 	}
 
 	void print() {
@@ -8,11 +8,13 @@
 struct Vertex {
 	double x;
 	double y;
+};
 
-	// unique ID of trajectory in dataset
-	int trajectoryNumber;
-
-	// true -> this vertex is the start of trajectory
-	// probably not the most elegant
-	bool isStart;
-};
\ No newline at end of file
+// Geometry of the segment from vertex i to vertex i + 1, precomputed once per trajectory
+// because every segment is visited many times by the freespace and ETD computations
+struct Segment {
+	double dx;
+	double dy;
+	double lengthSQ;
+	double invLength;
+};
@@ -0,0 +1,170 @@
+#pragma once
+
+#include "Vertex.h"
+#include "Trajectory.h"
+#include "BoundingBox.h"
+
+#include <vector>
+#include <algorithm>
+#include <cmath>
+
+// Regular grid over the vertices of all dataset trajectories. Every trajectory stores the
+// (sorted, distinct) grid cells its vertices lie in. A query fills a distance field over the
+// grid with a lower bound of the distance from each cell to the query trajectory. Since every
+// vertex of a trajectory has to be matched to a point of the query, the largest field value over
+// the cells of a trajectory is a lower bound for the frechet distance (a directed Hausdorff bound).
+// Vertices of a simplification can be indexed instead of all vertices, they are a subset.
+class VertexIndex
+{
+public:
+	// Per worker distance field. Cells are valid when their stamp is the current one,
+	// all other cells are further away than the delta the field was filled for.
+	struct Field {
+		std::vector<double> dist;
+		std::vector<int> stamp;
+		int current = 0;
+		bool valid = false;
+	};
+
+	double minx = 0;
+	double miny = 0;
+	double cellSize = 1;
+	int cols = 0;
+	int rows = 0;
+	// level of the simplification that was indexed, -1 for all vertices
+	int level = -1;
+
+	// cells of trajectory i are cells[cellStart[i]] to cells[cellStart[i + 1]]
+	std::vector<long> cellStart;
+	std::vector<int> cells;
+
+	// grid cells a query may fill before the field is not used for that query
+	long maxFieldWork = 1 << 22;
+
+	// Indexes the vertices of simplification level (or all vertices for -1) of every trajectory.
+	// Returns false if the cells would take more than budget bytes.
+	bool build(std::vector<Trajectory*> &trajectories, BoundingBox &box, double iCellSize, int iLevel, size_t budget) {
+		minx = box.minx;
+		miny = box.miny;
+		cellSize = iCellSize;
+		cols = std::max(1, (int)ceil((box.maxx - box.minx) / cellSize) + 1);
+		rows = std::max(1, (int)ceil((box.maxy - box.miny) / cellSize) + 1);
+		level = iLevel;
+		cellStart.assign(1, 0);
+		cells.clear();
+		std::vector<int> own;
+		for (Trajectory *t : trajectories) {
+			if (t != nullptr) {
+				own.clear();
+				int size = level < 0 ? t->size : t->simplifications[level]->size;
+				Vertex *vertices = level < 0 ? t->vertices.data() : t->simplifications[level]->vertices.data();
+				for (int i = 0; i < size; i++) {
+					int c = cellOf(vertices[i].x, vertices[i].y);
+					if (own.empty() || own.back() != c) {
+						own.push_back(c);
+					}
+				}
+				std::sort(own.begin(), own.end());
+				own.erase(std::unique(own.begin(), own.end()), own.end());
+				cells.insert(cells.end(), own.begin(), own.end());
+				if (bytes() > budget) {
+					return false;
+				}
+			}
+			cellStart.push_back(cells.size());
+		}
+		cells.shrink_to_fit();
+		return true;
+	}
+
+	size_t bytes() {
+		return cells.size() * sizeof(int) + cellStart.size() * sizeof(long);
+	}
+
+	size_t fieldBytes() {
+		return (size_t)cols * rows * (sizeof(double) + sizeof(int));
+	}
+
+	// Fills the field with the distance lower bounds of all cells within delta of the query trajectory.
+	// Leaves the field invalid when the query would touch too many cells.
+	void fill(Field &field, Trajectory &queryTrajectory, double delta) {
+		field.valid = false;
+		if (queryTrajectory.size < 2) return;
+		double halfDiagonal = cellSize * sqrt(0.5);
+		double reach = delta + halfDiagonal;
+		long work = 0;
+		for (int i = 0; i + 1 < queryTrajectory.size; i++) {
+			Vertex &p = queryTrajectory.vertices[i];
+			Vertex &q = queryTrajectory.vertices[i + 1];
+			work += (long)(fabs(p.x - q.x) / cellSize + 2 * reach / cellSize + 2) * (long)(fabs(p.y - q.y) / cellSize + 2 * reach / cellSize + 2);
+		}
+		if (work > maxFieldWork) return;
+
+		if (field.dist.size() != (size_t)cols * rows) {
+			field.dist.assign((size_t)cols * rows, 0);
+			field.stamp.assign((size_t)cols * rows, 0);
+			field.current = 0;
+		}
+		field.current++;
+		for (int i = 0; i + 1 < queryTrajectory.size; i++) {
+			Vertex &p = queryTrajectory.vertices[i];
+			Vertex &q = queryTrajectory.vertices[i + 1];
+			double dx = q.x - p.x;
+			double dy = q.y - p.y;
+			double lengthSQ = dx * dx + dy * dy;
+			int x0 = column(std::min(p.x, q.x) - reach);
+			int x1 = column(std::max(p.x, q.x) + reach);
+			int y0 = row(std::min(p.y, q.y) - reach);
+			int y1 = row(std::max(p.y, q.y) + reach);
+			for (int y = y0; y <= y1; y++) {
+				for (int x = x0; x <= x1; x++) {
+					// distance from the cell center to the segment, minus the distance to the cell corners
+					double cx = minx + (x + 0.5) * cellSize;
+					double cy = miny + (y + 0.5) * cellSize;
+					double t = lengthSQ > 0 ? ((cx - p.x) * dx + (cy - p.y) * dy) / lengthSQ : 0;
+					t = std::max(0.0, std::min(1.0, t));
+					double ex = p.x + t * dx - cx;
+					double ey = p.y + t * dy - cy;
+					double d = std::max(0.0, sqrt(ex * ex + ey * ey) - halfDiagonal);
+					if (d > delta) continue;
+					long c = (long)y * cols + x;
+					if (field.stamp[c] != field.current) {
+						field.stamp[c] = field.current;
+						field.dist[c] = d;
+					}
+					else if (d < field.dist[c]) {
+						field.dist[c] = d;
+					}
+				}
+			}
+		}
+		field.valid = true;
+	}
+
+	// Lower bound for the frechet distance between the query of the field and dataset trajectory
+	// number trajectoryNumber, INFINITY when it is further than the delta the field was filled for.
+	double lowerBound(Field &field, int trajectoryNumber) {
+		double bound = 0;
+		for (long i = cellStart[trajectoryNumber]; i < cellStart[trajectoryNumber + 1]; i++) {
+			int c = cells[i];
+			if (field.stamp[c] != field.current) {
+				return INFINITY;
+			}
+			bound = std::max(bound, field.dist[c]);
+		}
+		return bound;
+	}
+
+private:
+	inline int column(double x) {
+		return (int)std::max(0.0, std::min(cols - 1.0, floor((x - minx) / cellSize)));
+	}
+
+	inline int row(double y) {
+		return (int)std::max(0.0, std::min(rows - 1.0, floor((y - miny) / cellSize)));
+	}
+
+	inline int cellOf(double x, double y) {
+		return row(y) * cols + column(x);
+	}
+};
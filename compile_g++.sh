@@ -1 +1,3 @@
-g++ FrechetCompImpl.cpp -std=c++11 -lpthread
\ No newline at end of file
+g++ FrechetCompImpl.cpp -std=c++11 -lpthread
+g++ FrechetClient.cpp -std=c++11 -lpthread -o FrechetClient
+g++ FrechetIndexExample.cpp FrechetIndexExampleLoad.cpp -std=c++11 -lpthread -o FrechetIndexExample
@@ -1,11 +1,18 @@
 
 // Program-wide defines
-#define WRITE_OUTPUT_TO_QUERY true	// true -> outputfiles (result-XXXXX.txt) are created when queries are solved
+#define WRITE_OUTPUT_TO_QUERY true	// true -> query results are written (results.txt, or result-XXXXX.txt files with --per-query-results)
 #define USE_GPU false				// true -> OpenCL is used (DONT FLIP THIS, DOESNT WORK (yet))
 #define USE_MULTITHREAD true		// false -> use only one thread, useful to debug concurrency issues
 #define USE_FAST_IO true			// true -> file loading is faster, but less robust
 #define ONLY_TOTAL_TIMES false		// true -> print diagnostic information
-#define USE_FOPEN_S true			// true -> using windows file API
+#define USE_SIMD_INTERVALS true		// true -> freespace columns are swept with batched (AVX2 when available) interval computations
+#define USE_ENDPOINT_INDEX true		// true -> start/end queries use the joint 4D kd-tree, false -> DiHash on start points only
+#define USE_DUAL_DECISION true		// true -> simplification pruning decides both tri. ineq. epsilons in one freespace sweep
+#define USE_CORRIDOR_DECISION true	// true -> full resolution decisions first search the corridor around the reachable region of the last simplification
+#define USE_INTRA_QUERY_PARALLEL true	// true -> idle workers help deciding the candidates of query groups still being solved
+#define USE_BBOX_FILTER true		// true -> candidates whose bounding box is further than delta from the query bounding box are rejected
+#define USE_SAMPLE_FILTER true		// true -> candidates are rejected when sampled vertices lie further than delta from the other bounding box
+#define USE_VERTEX_INDEX false		// true -> a grid over all dataset vertices rejects candidates with a vertex far from the query, see vertexIndexBudgetMB
 
 
 #define TRAJECTORY_FILES_OFFSET "" // directory appended to the load function, set to "" if the trajectory files are in the same folder as the executable